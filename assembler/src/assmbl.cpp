@@ -1,14 +1,18 @@
 #include "assmbl.h"
 #include "dbg.h"
 
-void masm::assmbl::assemble(parser::pctx& pctx, layt::lctx &&lctx, std::ostream& os) {
+void masm::assmbl::assemble(parser::pctx& pctx, layt::lctx &&lctx, std::vector<uint8_t>& out) {
 	auto put = [&](auto num){
 		for (int i = 0; i < sizeof(num); ++i) {
-			os.put(num & 0xff);
+			out.push_back(num & 0xff);
 			num >>= 8;
 		}
 	};
 
+	size_t total = out.size();
+	for (const auto& section : lctx.sections) total += 8 + section.length();
+	out.reserve(total);
+
 	for (auto& section : lctx.sections) {
 		// Output a section header (addr+length)
 		put(section.base_address);
@@ -21,27 +25,31 @@ void masm::assmbl::assemble(parser::pctx& pctx, layt::lctx &&lctx, std::ostream&
 						// switch on type
 						switch (content.d_data.type) {
 							case parser::rawdata::BYTES:
-								os.put(lctx.evalt.completely_evaluate<uint8_t>(content.d_data.low));
-								os.put(lctx.evalt.completely_evaluate<uint8_t>(content.d_data.high));
+								out.push_back(lctx.evalt.completely_evaluate<uint8_t>(content.low_code));
+								out.push_back(lctx.evalt.completely_evaluate<uint8_t>(content.high_code));
 								break;
 							case parser::rawdata::WORD:
 								{
-									uint16_t x = lctx.evalt.completely_evaluate<uint16_t>(content.d_data.low);
+									uint16_t x = lctx.evalt.completely_evaluate<uint16_t>(content.low_code);
 									put(x);
 									break;
 								}
 							case parser::rawdata::DOUBLEWORD:
 								{
-									uint32_t x = lctx.evalt.completely_evaluate<uint32_t>(content.d_data.low);
+									uint32_t x = lctx.evalt.completely_evaluate<uint32_t>(content.low_code);
 									put(x);
 									break;
 								}
 							case parser::rawdata::QUADWORD:
 								{
-									uint64_t x = lctx.evalt.completely_evaluate<uint64_t>(content.d_data.low);
+									uint64_t x = lctx.evalt.completely_evaluate<uint64_t>(content.low_code);
 									put(x);
 									break;
 								}
+							case parser::rawdata::SPAN:
+								out.insert(out.end(), content.d_data.bytes.get(), content.d_data.bytes.get() + content.d_data.size);
+								if (content.d_data.size % 2) out.push_back(0);
+								break;
 						}
 						break;
 					case layt::concreteinsn::INSN:
@@ -50,23 +58,23 @@ void masm::assmbl::assemble(parser::pctx& pctx, layt::lctx &&lctx, std::ostream&
 								put(insn::build_short_insn(content.rd, content.ro, content.opcode));
 								break;
 							case layt::concreteinsn::I_TINY:
-								put(insn::build_timm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm), content.opcode));
+								put(insn::build_timm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm_code), content.opcode));
 								break;
 							// long insns
 							case layt::concreteinsn::I_LONG:
-								put(insn::build_imm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm), content.rs, content.ro, content.opcode));
+								put(insn::build_imm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm_code), content.rs, content.ro, content.opcode));
 								break;
 							case layt::concreteinsn::I_BIG:
-								put(insn::build_bigimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm), content.opcode));
+								put(insn::build_bigimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm_code), content.opcode));
 								break;
 							case layt::concreteinsn::I_MED:
-								put(insn::build_mediimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm), content.ro, content.opcode));
+								put(insn::build_mediimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm_code), content.ro, content.opcode));
 								break;
 							case layt::concreteinsn::I_MSM:
-								put(insn::build_msmimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm), content.FF, content.ro, content.opcode));
+								put(insn::build_msmimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm_code), content.FF, content.ro, content.opcode));
 								break;
 							case layt::concreteinsn::I_SM:
-								put(insn::build_smimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm), content.FF, content.rs, content.ro, content.opcode));
+								put(insn::build_smimm_insn(content.rd, lctx.evalt.completely_evaluate<uint32_t>(content.imm_code), content.FF, content.rs, content.ro, content.opcode));
 							default:
 								break;
 						}
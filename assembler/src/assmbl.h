@@ -1,7 +1,9 @@
 #pragma once
 
+#include <vector>
 #include "layt.h"
 
 namespace masm::assmbl {
-	void assemble(parser::pctx& pctx, layt::lctx &&lctx, std::ostream& os);
+	// Append the image (each section as address, length then contents) to out
+	void assemble(parser::pctx& pctx, layt::lctx &&lctx, std::vector<uint8_t>& out);
 }
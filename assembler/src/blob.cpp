@@ -0,0 +1,37 @@
+#include "blob.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace masm::blob {
+	std::shared_ptr<const uint8_t> map(const std::string& path, size_t &length) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("unable to open " + path + ": " + strerror(errno));
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			close(fd);
+			throw std::runtime_error("unable to stat " + path + ": " + strerror(errno));
+		}
+		length = st.st_size;
+
+		// mmap refuses empty files, but there's nothing to map anyway
+		if (!length) {
+			close(fd);
+			return std::make_shared<const uint8_t>(0);
+		}
+
+		void *m = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) throw std::runtime_error("unable to map " + path + ": " + strerror(errno));
+
+		size_t mapped = length;
+		return std::shared_ptr<const uint8_t>((const uint8_t *)m, [mapped](const uint8_t *p){ munmap((void *)p, mapped); });
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+namespace masm::blob {
+	// Map a whole file read-only. The mapping stays alive as long as any copy of the returned pointer
+	// (or one aliasing it) does; length is set to the file's size. Throws std::runtime_error if the file
+	// can't be opened or mapped.
+	std::shared_ptr<const uint8_t> map(const std::string& path, size_t &length);
+}
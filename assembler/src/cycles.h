@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+
+// Cycle costs of the core, which both mcasm's worst-case analysis (wcet.h) and the simulator's
+// estimates (sim/src/timing.h) start from. Either can be given other numbers at run time.
+namespace masm::cycles {
+	// issuing an instruction with each encoding (S A L B M F T), once its bus words are in
+	inline constexpr std::array<uint32_t, 7> issue = {1, 1, 2, 2, 2, 2, 2};
+	// extra for anything that wrote pc (refilling the pipeline)
+	inline constexpr uint32_t taken = 2;
+	// entering an interrupt
+	inline constexpr uint32_t irq = 2;
+	// extra for div/mod, which wait on the divider
+	inline constexpr uint32_t divide = 33;
+	// one bus word access to each target, in msim::target order: rom, sram, sdram, unmapped,
+	// cpuregs, vram
+	inline constexpr std::array<uint32_t, 6> latency = {1, 1, 8, 1, 1, 2};
+}
@@ -2,8 +2,6 @@
 #include <bitset>
 #include <ranges>
 
-bool is_error_reported_yet = false;
-
 namespace {
 	void dump(std::ostream &os, const std::ranges::range auto& obj, const char *sep) {
 		bool f = false;
@@ -117,6 +115,10 @@ std::ostream& operator<<(std::ostream& os, const masm::parser::pctx &pctx) {
 					os << "l" << insn.lbl.section << "i" << insn.lbl.index << ":";
 					break;
 				case masm::parser::insn::DATA:
+					if (insn.raw.type == masm::parser::rawdata::SPAN) {
+						os << "  span{size=" << insn.raw.size << "}";
+						break;
+					}
 					os << "  db{width=" << insn.raw.type << "}, 0x" << std::hex << insn.raw.low;
 					if (insn.raw.type == masm::parser::rawdata::BYTES) os << ", 0x" << insn.raw.high;
 					os << std::dec;
@@ -138,6 +140,10 @@ std::ostream& operator<<(std::ostream& os, const masm::layt::lctx &lctx) {
 			os << std::hex << std::setw(10) << addr << std::dec << std::setw(0) << ": ";
 			switch (insn.type) {
 				case masm::layt::concreteinsn::DATA:
+					if (insn.d_data.type == masm::parser::rawdata::SPAN) {
+						os << "span{size=" << insn.d_data.size << "}";
+						break;
+					}
 					os << "db{width=" << insn.d_data.type << "}, 0x" << std::hex << insn.d_data.low;
 					if (insn.d_data.type == masm::parser::rawdata::BYTES) os << ", 0x" << insn.d_data.high;
 					os << std::dec;
@@ -175,25 +181,12 @@ std::ostream& operator<<(std::ostream& os, const masm::layt::lctx &lctx) {
 	return os;
 }
 
-void report_error(const masm::parser::pctx& ctx, const yy::location &l, const std::string &m) {
-	std::cerr << (l.begin.filename ? l.begin.filename->c_str() : "(undefined)");
-	std::cerr << ':' << l.begin.line << ':' << l.begin.column << '-' << l.end.column << ": " << m << '\n';
-
-	try {
-		const char * line = ctx.start + ctx.lineoffsets.at(l.begin.line - 1);
-		std::cerr << std::setw(6) << std::right << l.begin.line << " | ";
-		while (*line && *line != '\n') {
-			std::cerr << *line++;
-		}
-		std::cerr << "\n         ";
-		for (size_t i = 0; i < l.begin.column - 1; ++i) {
-			std::cerr << ' ';
-		}
-		for (size_t i = 0; i < (l.end.column - l.begin.column); ++i) {
-			std::cerr << (i == 0 ? '^' : '~');
-		}
-		std::cerr << "\n";
-	}
-	catch (const std::out_of_range &e) {}
-	is_error_reported_yet = true;
+void report_error(masm::parser::pctx& ctx, const yy::location &l, const std::string &m) {
+	ctx.diagnostics.push_back({
+		.file = l.begin.filename ? *l.begin.filename : std::string("(undefined)"),
+		.line = l.begin.line,
+		.column = l.begin.column,
+		.end_column = l.end.column,
+		.message = m
+	});
 }
@@ -11,7 +11,7 @@ std::ostream& operator<<(std::ostream& os, const masm::parser::insn_arg &arg);
 std::ostream& operator<<(std::ostream& os, const masm::parser::pctx &pctx);
 std::ostream& operator<<(std::ostream& os, const masm::layt::lctx &pctx);
 
-void report_error(const masm::parser::pctx& ctx, const yy::location &l, const std::string &m);
-extern bool is_error_reported_yet;
+// Record an error against the program being assembled
+void report_error(masm::parser::pctx& ctx, const yy::location &l, const std::string &m);
 
 #endif
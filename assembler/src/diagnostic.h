@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+namespace masm {
+	// An error, pointing at the span of source it's about (lines and columns start at 1, the
+	// end column is one past the last character). One without a file is about the options given.
+	struct diagnostic {
+		std::string file;
+		int line = 0, column = 0, end_column = 0;
+		std::string message;
+	};
+}
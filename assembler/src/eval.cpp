@@ -1,8 +1,53 @@
 #include "eval.h"
 #include <algorithm>
+#include <optional>
+#include <vector>
 #include "dbg.h"
 
 namespace masm::eval {
+	namespace {
+		// If expr is k * label (in any arrangement of neg/mul with constants), return label and k
+		std::optional<std::pair<parser::labelname, int64_t>> scaled_label(const parser::expr& e) {
+			switch (e.type) {
+				case parser::expr::label:
+					return std::make_pair(e.label_value, (int64_t)1);
+				case parser::expr::neg:
+					if (auto inner = scaled_label(e.args.front())) {
+						inner->second = -inner->second;
+						return inner;
+					}
+					return std::nullopt;
+				case parser::expr::mul:
+					{
+						std::optional<std::pair<parser::labelname, int64_t>> result;
+						int64_t k = 1;
+						for (const auto& arg : e.args) {
+							if (arg.type == parser::expr::num) k *= arg.constant_value;
+							else if (!result && (result = scaled_label(arg))) ;
+							else return std::nullopt;
+						}
+						if (result) result->second *= k;
+						return result;
+					}
+				default:
+					return std::nullopt;
+			}
+		}
+
+		// Is e already written the way simplify_eliminate would write k * label?
+		bool is_canonical_scaled(const parser::expr& e, int64_t k) {
+			switch (k) {
+				case 1:
+					return e.type == parser::expr::label;
+				case -1:
+					return e.type == parser::expr::neg && e.args.front().type == parser::expr::label;
+				default:
+					return e.type == parser::expr::mul && e.args.size() == 2 &&
+						e.args.front().type == parser::expr::num && e.args.back().type == parser::expr::label;
+			}
+		}
+	}
+
 	template<typename Func>
 	void evaluator::evaluate_commutative(parser::expr& expr, Func&& func) const {
 		auto rng = expr.args | std::views::filter([](const parser::expr& e){return e.type == parser::expr::num;});
@@ -130,6 +175,227 @@ namespace masm::eval {
 		) {;}
 	}
 
+	void evaluator::simplify(parser::insn& insn) const {
+		switch (insn.type) {
+			case parser::insn::LOADSTORE:
+				simplify(insn.addr.constant);
+				[[fallthrough]];
+			case parser::insn::ALU:
+			case parser::insn::MOV:
+				for (auto& arg : insn.args) {
+					switch (arg.mode) {
+						case parser::insn_arg::CONSTANT:
+						case parser::insn_arg::REGISTER_PLUS:
+							simplify(arg.constant);
+						default:
+							break;
+					}
+				}
+				break;
+			case parser::insn::DATA:
+				if (insn.raw.type == parser::rawdata::SPAN) break;
+				simplify(insn.raw.low);
+				if (insn.raw.type == parser::rawdata::BYTES) {
+					simplify(insn.raw.high);
+				}
+			default:
+				break;
+		}
+	}
+
+	void evaluator::define(const parser::labelname& lbl, int64_t value) {
+		labelvalues[lbl] = parser::expr(value);
+		uint32_t slot = slot_of(lbl);
+		slot_values[slot] = value;
+		slot_defined[slot] = true;
+	}
+
+	uint32_t evaluator::slot_of(const parser::labelname& lbl) {
+		auto [it, added] = slots.try_emplace(lbl, (uint32_t)slot_values.size());
+		if (added) {
+			slot_values.push_back(0);
+			slot_defined.push_back(false);
+		}
+		return it->second;
+	}
+
+	program evaluator::compile(const parser::expr& expr) {
+		program prog;
+		if (expr.type != parser::expr::undef) compile_(expr, prog, 0);
+		return prog;
+	}
+
+	void evaluator::compile_(const parser::expr& expr, program& prog, size_t height) {
+		switch (expr.type) {
+			case parser::expr::num:
+				prog.ops.push_back({program::CONST, 0, expr.constant_value});
+				prog.depth = std::max(prog.depth, height + 1);
+				return;
+			case parser::expr::label:
+				prog.ops.push_back({program::LABEL, 0, slot_of(expr.label_value)});
+				prog.depth = std::max(prog.depth, height + 1);
+				return;
+			case parser::expr::undef:
+				throw std::domain_error("undefined value in expression");
+			default:
+				break;
+		}
+
+		// Operands end up on the stack in order
+		size_t n = 0;
+		for (const auto& arg : expr.args) compile_(arg, prog, height + n++);
+
+		program::opcode code;
+		switch (expr.type) {
+			case parser::expr::neg:    code = program::NEG; break;
+			case parser::expr::add:    code = program::ADD; break;
+			case parser::expr::mul:    code = program::MUL; break;
+			case parser::expr::div:    code = program::DIV; break;
+			case parser::expr::mod:    code = program::MOD; break;
+			case parser::expr::lshift: code = program::LSHIFT; break;
+			case parser::expr::rshift: code = program::RSHIFT; break;
+			default:
+				throw std::logic_error("invalid type in compile");
+		}
+		prog.ops.push_back({code, (uint32_t)n, 0});
+	}
+
+	int64_t evaluator::run(const program& prog) const {
+		if (prog.ops.empty()) return 0;
+		if (stack.size() < prog.depth) stack.resize(prog.depth);
+
+		int64_t *sp = stack.data();
+		for (const auto& op : prog.ops) {
+			switch (op.code) {
+				case program::CONST:
+					*sp++ = op.operand;
+					continue;
+				case program::LABEL:
+					if (!slot_defined[op.operand]) throw std::domain_error("did not completely evaluate expression");
+					*sp++ = slot_values[op.operand];
+					continue;
+				case program::NEG:
+					sp[-1] = -sp[-1];
+					continue;
+				default:
+					break;
+			}
+
+			// Fold operands into the first one
+			int64_t *first = sp - op.count;
+			int64_t acc = *first;
+			for (int64_t *arg = first + 1; arg != sp; ++arg) {
+				switch (op.code) {
+					case program::ADD:    acc += *arg; break;
+					case program::MUL:    acc *= *arg; break;
+					case program::LSHIFT: acc <<= *arg; break;
+					case program::RSHIFT: acc >>= *arg; break;
+					case program::DIV:
+					case program::MOD:
+						if (*arg == 0) throw std::domain_error("division by zero");
+						if (op.code == program::DIV) acc /= *arg;
+						else acc %= *arg;
+						break;
+					default:
+						throw std::logic_error("invalid opcode in run");
+				}
+			}
+			*first = acc;
+			sp = first + 1;
+		}
+
+		return stack.front();
+	}
+
+	bool evaluator::simplify_eliminate(parser::expr& e) const {
+		if (e.type == parser::expr::neg) {
+			auto& inner = e.args.front();
+			switch (inner.type) {
+				case parser::expr::neg:
+					{
+						// --x = x
+						parser::expr x = std::move(inner.args.front());
+						e = std::move(x);
+						return true;
+					}
+				case parser::expr::add:
+					{
+						// -(a + b) = -a + -b, so the terms can be collected with whatever this is added to
+						std::list<parser::expr> negated;
+						for (auto& term : inner.args) negated.emplace_back(parser::expr::make_neg(std::move(term)));
+						e = parser::expr::make_add();
+						e.args = std::move(negated);
+						return true;
+					}
+				default:
+					return false;
+			}
+		}
+
+		if (e.type != parser::expr::add) return false;
+
+		// Split the sum into a constant, a coefficient per label (in order of appearance) and
+		// anything else.
+		int64_t constant = 0;
+		size_t constant_terms = 0;
+		bool changed = false;
+		std::vector<std::pair<parser::labelname, int64_t>> coefficients;
+
+		for (const auto& term : e.args) {
+			if (term.type == parser::expr::num) {
+				constant += term.constant_value;
+				++constant_terms;
+			}
+			else if (auto scaled = scaled_label(term)) {
+				auto it = std::find_if(coefficients.begin(), coefficients.end(), [&](const auto& c){return c.first == scaled->first;});
+				if (it != coefficients.end()) {
+					it->second += scaled->second;
+					changed = true;
+				}
+				else {
+					coefficients.push_back(*scaled);
+					changed = changed || scaled->second == 0 || !is_canonical_scaled(term, scaled->second);
+				}
+			}
+		}
+
+		changed = changed || constant_terms > 1 || (constant_terms == 1 && constant == 0);
+		if (!changed) return false;
+
+		std::list<parser::expr> others;
+		for (auto& term : e.args) {
+			if (term.type != parser::expr::num && !scaled_label(term)) others.emplace_back(std::move(term));
+		}
+
+		// Rebuild as constant + k0 * label0 + ... + others
+		std::list<parser::expr> terms;
+		if (constant != 0) terms.emplace_back(constant);
+		for (const auto& [lbl, k] : coefficients) {
+			switch (k) {
+				case 0:
+					break;
+				case 1:
+					terms.emplace_back(lbl);
+					break;
+				case -1:
+					terms.emplace_back(parser::expr::make_neg(parser::expr(lbl)));
+					break;
+				default:
+					terms.emplace_back(parser::expr::make_mul(parser::expr(k), parser::expr(lbl)));
+					break;
+			}
+		}
+		terms.splice(terms.end(), others);
+
+		if (terms.empty()) e.replace((int64_t)0);
+		else if (terms.size() == 1) {
+			parser::expr x = std::move(terms.front());
+			e = std::move(x);
+		}
+		else e.args = std::move(terms);
+		return true;
+	}
+
 	bool evaluator::simplify_flatten(parser::expr& e) const {
 		switch (e.type) {
 			case parser::expr::mul:
@@ -4,14 +4,53 @@
 #include <parser.h>
 #include <stdexcept>
 #include <string.h>
+#include <vector>
 
 namespace masm::eval {
+	// An expression lowered to postfix form, with labels referring to slots in the evaluator
+	// that compiled it. Cheap to run as many times as needed once labels are (re)assigned.
+	struct program {
+		enum opcode : uint8_t {
+			CONST,  // push operand
+			LABEL,  // push value of slot operand
+			NEG,
+			// pop count values and fold them left to right
+			ADD,
+			MUL,
+			DIV,
+			MOD,
+			LSHIFT,
+			RSHIFT
+		};
+
+		struct op {
+			opcode code;
+			uint32_t count;
+			int64_t operand;
+		};
+
+		// empty for an undefined expression, which evaluates to 0
+		std::vector<op> ops;
+		// deepest the stack gets
+		size_t depth = 0;
+	};
+
 	struct evaluator {
 		std::map<parser::labelname, parser::expr> labelvalues;
 
+		// Set a label's value, both for evaluating expressions and compiled programs.
+		void define(const parser::labelname& lbl, int64_t value);
+
+		// Lower an expression to a program. Labels without values yet are fine, they only have
+		// to be defined by the time the program runs.
+		program compile(const parser::expr& expr);
+
 		// Write expr in a simpler way, making partial evaluates work better.
 		void simplify(parser::expr& expr) const;
 
+		// Simplify every expression in an instruction.
+		void simplify(parser::insn& insn) const;
+
 		// Evaluate an expression as far as possible, returning true if the result is reduced
 		// to just a value (which also includes just a label)
 		bool evaluate(parser::expr& expr) const;
@@ -45,7 +84,31 @@ namespace masm::eval {
 			}
 		}
 
+		// Run a compiled program, throwing if it uses a label that has no value.
+		template<typename Result>
+		Result completely_evaluate(const program& prog) const {
+			static_assert(std::is_integral_v<Result>, "completely evaluate must give an integer");
+			static_assert(sizeof(Result) <= sizeof(int64_t));
+
+			int64_t value = run(prog);
+			Result val;
+			memcpy(&val, &value, sizeof(Result));
+			return val;
+		}
+
 	private:
+		// Label slots for compiled programs
+		std::map<parser::labelname, uint32_t> slots;
+		std::vector<int64_t> slot_values;
+		std::vector<bool> slot_defined;
+
+		// Scratch stack reused across runs
+		mutable std::vector<int64_t> stack;
+
+		uint32_t slot_of(const parser::labelname& lbl);
+		void compile_(const parser::expr& expr, program& prog, size_t height);
+		int64_t run(const program& prog) const;
+
 		// Implemented in c++ file since it's only referred to there.
 		template<typename Func>
 		void evaluate_commutative(parser::expr& expr, Func&& f) const;
@@ -67,11 +130,13 @@ namespace masm::eval {
 		//  |- num 1
 		bool simplify_flatten(parser::expr& expr) const;
 
-		// Eliminate like terms TODO
+		// Eliminate like terms
 		//
-		// Allows for an offsetof-like macro to be simplified into a constant
-		// for better instruction packing.
-		bool simplify_eliminate(parser::expr& expr) const {return false;}
+		// Pushes negation into sums and collects the coefficient of each label in a sum, so
+		// that e.g. (a + 8) - a becomes 8. Allows for an offsetof-like macro to be simplified
+		// into a constant for better instruction packing. Only returns true if the expression
+		// actually changed.
+		bool simplify_eliminate(parser::expr& expr) const;
 
 		bool simplify_(parser::expr& expr) const;
 	};
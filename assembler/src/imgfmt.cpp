@@ -0,0 +1,89 @@
+#include "imgfmt.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace masm::imgfmt {
+	namespace {
+		uint32_t get32(const uint8_t *p) {
+			return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+
+		void put(uint8_t *p, uint64_t v, int bytes) {
+			for (int i = 0; i < bytes; ++i) p[i] = (v >> (i * 8)) & 0xff;
+		}
+
+		// Call f(base, contents, length) for every record of a stream image (which assemble() made,
+		// so it's well formed)
+		template<typename F>
+		void each_section(const std::vector<uint8_t>& stream, F&& f) {
+			for (size_t ptr = 0; ptr + 8 <= stream.size();) {
+				uint32_t base = get32(&stream[ptr]), len = get32(&stream[ptr + 4]);
+				f(base, stream.data() + ptr + 8, (size_t)len);
+				ptr += 8 + len;
+			}
+		}
+	}
+
+	std::vector<uint8_t> to_paged(const std::vector<uint8_t>& stream) {
+		struct entry {
+			uint32_t base;
+			const uint8_t *data;
+			size_t length;
+		};
+		std::vector<entry> sections;
+		each_section(stream, [&](uint32_t base, const uint8_t *data, size_t length){
+			sections.push_back({base, data, length});
+		});
+
+		auto page_up = [](size_t x){ return (x + paged_page_size - 1) & ~(size_t)(paged_page_size - 1); };
+
+		size_t end = page_up(paged_header_size + sections.size() * paged_entry_size);
+		std::vector<size_t> offsets;
+		for (const auto& s : sections) {
+			offsets.push_back(end);
+			end = page_up(end + s.length);
+		}
+
+		std::vector<uint8_t> out(end);
+		memcpy(out.data(), paged_magic, sizeof paged_magic);
+		put(&out[0x08], paged_version, 4);
+		put(&out[0x0c], paged_page_size, 4);
+		put(&out[0x10], sections.size(), 4);
+		for (size_t i = 0; i < sections.size(); ++i) {
+			uint8_t *e = &out[paged_header_size + i * paged_entry_size];
+			put(e, sections[i].base, 4);
+			put(e + 4, sections[i].length, 4);
+			put(e + 8, offsets[i], 8);
+			if (sections[i].length) memcpy(&out[offsets[i]], sections[i].data, sections[i].length);
+		}
+		return out;
+	}
+
+	void write_readmemh(const std::vector<uint8_t>& stream, uint32_t base, std::ostream& os) {
+		base &= ~1u;
+		// by word offset from base; sections that end or start on an odd byte can share a word
+		std::map<uint32_t, uint16_t> words;
+		each_section(stream, [&](uint32_t at, const uint8_t *data, size_t length){
+			for (size_t i = 0; i < length; ++i) {
+				uint32_t addr = at + i;
+				if (addr < base || (addr ^ base) >> 30) continue;
+				uint16_t& w = words[(addr - base) >> 1];
+				w |= data[i] << ((addr & 1) * 8);
+			}
+		});
+
+		char buf[16];
+		uint32_t next = ~0u;
+		for (const auto& [offset, value] : words) {
+			if (offset != next) {
+				snprintf(buf, sizeof buf, "@%08x\n", offset);
+				os << buf;
+			}
+			snprintf(buf, sizeof buf, "%04x\n", value);
+			os << buf;
+			next = offset + 1;
+		}
+	}
+}
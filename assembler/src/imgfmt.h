@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+// Other forms of an assembled image, converted from the stream of (address, length, contents)
+// records that assemble() produces.
+//
+// Paged images are for loaders that would rather map the file than parse it. They start with a
+// fixed header:
+//
+//   0x00  "MCPUPAGE"
+//   0x08  u32 version (1)
+//   0x0c  u32 page size (4096)
+//   0x10  u32 section count
+//   0x14  12 bytes, zero
+//
+// followed by the index, one entry per section in the order they were in the stream:
+//
+//   u32 base address, u32 length, u64 file offset of the contents
+//
+// Every section's contents start on a page boundary, with zeros in between. All little endian.
+
+namespace masm::imgfmt {
+	inline constexpr char paged_magic[8] = {'M', 'C', 'P', 'U', 'P', 'A', 'G', 'E'};
+	inline constexpr uint32_t paged_version = 1;
+	inline constexpr uint32_t paged_page_size = 4096;
+	inline constexpr size_t paged_header_size = 32;
+	inline constexpr size_t paged_entry_size = 16;
+
+	std::vector<uint8_t> to_paged(const std::vector<uint8_t>& stream);
+
+	// $readmemh text for a memory of 16 bit words whose first word is at byte address base, as
+	// bus_bram takes for INIT. Only what lies between base and the end of its quadrant of the
+	// address space is written, everything else is for some other memory.
+	void write_readmemh(const std::vector<uint8_t>& stream, uint32_t base, std::ostream& os);
+}
@@ -18,6 +18,81 @@ namespace masm::insn {
 		return (0b01 << 5) | (cond << 2) | op;
 	}
 
+	format::e format_for(uint32_t opcode, bool is_long) {
+		switch (opcode >> 5) {
+			case 0b00:
+				// load/store: M selects the long format
+				if (!is_long) return format::S;
+				return (opcode & 1) == load_store_address_mode::SIMPLE ? format::F : format::T;
+			case 0b01:
+				// mov: only load immediate has special formats
+				if ((opcode & 0b11) == mov_op::MIMM) {
+					if (((opcode >> 2) & 0b111) == mov_cond::AL) return is_long ? format::B : format::A;
+					return is_long ? format::L : format::S;
+				}
+				return is_long ? format::T : format::S;
+			default:
+				switch (opcode & 0b11) {
+					case alu_sty::REG:
+						return is_long ? format::L : format::S;
+					case alu_sty::IMM:
+						return is_long ? format::M : format::A;
+					default:
+						return is_long ? format::T : format::S;
+				}
+		}
+	}
+
+	namespace {
+		int32_t sext(uint32_t value, size_t bits) {
+			uint32_t m = 1u << (bits - 1);
+			value &= (bits == 32 ? 0xffff'ffff : (1u << bits) - 1);
+			return (int32_t)((value ^ m) - m);
+		}
+	}
+
+	decoded decode(uint32_t raw) {
+		return decode(raw, format_for(raw & 0x7f, is_long_halfword(raw & 0xffff)));
+	}
+
+	decoded decode(uint32_t raw, format::e fmt) {
+		if (fmt == format::S || fmt == format::A) raw = (raw & 0xffff) | (raw << 16);
+
+		decoded d{};
+		d.opcode = raw & 0x7f;
+		d.fmt = fmt;
+		d.rd = raw >> 28;
+		d.rs = (raw >> 12) & 0xf;
+		d.ro = (raw >> 8) & 0xf;
+
+		switch (d.fmt) {
+			case format::S:
+				break;
+			case format::A:
+				d.imm = sext(raw >> 8, 4);
+				break;
+			case format::L:
+				d.imm = sext(raw >> 16, 12);
+				break;
+			case format::B:
+				d.imm = sext(raw >> 8, 20);
+				break;
+			case format::M:
+				d.imm = sext(raw >> 12, 16);
+				break;
+			case format::F:
+				d.imm = sext(raw >> 14, 14);
+				d.FF = (raw >> 12) & 0b11;
+				break;
+			case format::T:
+				d.imm = sext(raw >> 18, 10);
+				d.FF = (raw >> 16) & 0b11;
+				break;
+		}
+
+		return d;
+	}
+
 	void verify_register(uint32_t r) {
 		if (r > 15) throw std::domain_error("invalid register number; must fit in 4 bits");
 	}
@@ -88,7 +163,7 @@ namespace masm::insn {
 		if (!fits(imm, 14)) throw std::domain_error("immediate in F instruction must be 14 bits or less");
 		imm &= (1 << 14) - 1;
 
-		return (rd << 28) | (imm << 15) | (FF << 12) | (ro << 8) | (1 << 7) | opcode;
+		return (rd << 28) | (imm << 14) | (FF << 12) | (ro << 8) | (1 << 7) | opcode;
 	}
 
 	uint32_t build_smimm_insn(uint32_t rd, uint32_t imm, uint32_t FF, uint32_t rs, uint32_t ro, uint32_t opcode) {
@@ -41,12 +41,16 @@ namespace masm::insn {
 			SR   = 0b0011,
 			LSL  = 0b0100,
 			LSR  = 0b0101,
+			MUL  = 0b0110,
+			MULH = 0b0111, // signed
 			OR   = 0b1000,
 			EOR  = 0b1001,
 			AND  = 0b1010,
+			DIV  = 0b1011, // signed, rounds towards zero
 			NOR  = 0b1100,
 			ENOR = 0b1101,
-			NAND = 0b1110
+			NAND = 0b1110,
+			MOD  = 0b1111  // takes the sign of the dividend
 		};
 
 		using e = alu_op;
@@ -114,6 +118,53 @@ namespace masm::insn {
 		return (!top_bit && v_shift == 0) || (top_bit && v_shift == negative);
 	}
 
+	// Encoding formats, named after the letters in the ISA reference
+	namespace format {
+		enum format : uint32_t {
+			S, // short
+			A, // short with timm
+			L,
+			B,
+			M,
+			F,
+			T
+		};
+
+		using e = format;
+	}
+
+	// Which format an opcode is encoded with, given the long/short bit
+	format::e format_for(uint32_t opcode, bool is_long);
+
+	// Instruction fields pulled back out of an encoded instruction. Short instructions are
+	// duplicated into both halfwords first, just like the CPU does, so rd == rs for them.
+	struct decoded {
+		uint32_t opcode;
+		format::e fmt;
+		uint32_t rd, rs, ro, FF;
+		int32_t imm; // sign extended, 0 if the format has none
+
+		bool is_long() const {
+			return fmt != format::S && fmt != format::A;
+		}
+
+		size_t length() const {
+			return is_long() ? 4 : 2;
+		}
+	};
+
+	// Is the halfword at the start of an instruction the first half of a long instruction?
+	inline bool is_long_halfword(uint16_t first) {
+		return first & (1 << 7);
+	}
+
+	// Decode an instruction from its first two halfwords (low halfword first). The high
+	// halfword is ignored for short instructions.
+	decoded decode(uint32_t raw);
+
+	// Decode with the format already known (e.g. looked up by opcode in a table).
+	decoded decode(uint32_t raw, format::e fmt);
+
 	uint16_t build_short_insn(uint32_t rs_and_rd, uint32_t ro, uint32_t opcode);
 	uint16_t build_timm_insn(uint32_t rs_and_rd, uint32_t imm, uint32_t opcode);
 	uint32_t build_imm_insn(uint32_t rd, uint32_t imm, uint32_t rs, uint32_t ro, uint32_t opcode);
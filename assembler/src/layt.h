@@ -3,9 +3,11 @@
 #include <parser.h>
 #include "eval.h"
 #include "insns.h"
+#include <map>
 #include <numeric>
+#include <optional>
 
-extern void report_error(const masm::parser::pctx& ctx, const yy::location &l, const std::string &m);
+extern void report_error(masm::parser::pctx& ctx, const yy::location &l, const std::string &m);
 
 namespace masm::layt {
 	struct concreteinsn {
@@ -43,6 +45,21 @@ namespace masm::layt {
 		// immediate
 		parser::expr imm;
 
+		// imm (or the data) compiled against the evaluator's labels, which is what gets encoded
+		eval::program imm_code, low_code, high_code;
+
+		// carried through for analysis: the jmp of a call sequence, and any .bound given
+		bool is_call = false;
+		int64_t bound = -1;
+
+		// why an instruction that has a short form didn't get it (see stats.h)
+		enum miss {
+			MISS_NONE,
+			MISS_RD_RS,
+			MISS_SYMBOLIC,
+			MISS_WIDE
+		} missed = MISS_NONE;
+
 		// length in bytes (most useful for cpu addressing)
 		size_t length() const {
 			switch (type) {
@@ -58,6 +75,8 @@ namespace masm::layt {
 							return 4;
 						case parser::rawdata::QUADWORD:
 							return 8;
+						case parser::rawdata::SPAN:
+							return (d_data.size + 1) & ~(size_t)1;
 					}
 
 				case INSN:
@@ -99,41 +118,27 @@ namespace masm::layt {
 		// Layout the parsed data, loading labels into the evaluator.
 		bool layout_from(parser::pctx &pctx) {
 			bool ok = true;
+			std::vector<parser::section *> floating;
 			// Layout each section
 			for (auto& section : pctx.sections) {
+				// .float sections go wherever there's room left afterwards
+				if (section.floating) {
+					floating.push_back(&section);
+					continue;
+				}
 				// Create new empty layoutsection
 				sections.emplace_back();
 				// Copy properties
 				current().index = section.index;
 				current().base_address = evalt.completely_evaluate<uint32_t>(section.starting_address);
 
-				// Keep track of current address
-				uint32_t addr = current().base_address;
-
-				// Start parsing instructions
-				for (auto& insn : section.instructions) {
-					// Is this a label?
-					if (insn.type == parser::insn::LABEL) {
-						// Set the label's address
-						evalt.labelvalues[insn.lbl] = parser::expr(addr); // widening conversion works fine here
-					}
-					else {
-						try {
-							// Otherwise, layout
-							layout_instruction(std::move(insn));
-						}
-						catch (std::domain_error &e) {
-							ok = false;
-							::report_error(pctx, insn.progpos, e.what());
-						}
-						// Increment counter
-						addr += currenti().length();
-					}
-				}
+				if (section.irq < 0) ok &= layout_section(pctx, section.instructions);
+				else ok &= layout_handler(pctx, section);
 			}
+			if (!floating.empty()) ok &= layout_floating(pctx, floating);
 			// Detect overlaps (by first sorting)
 			std::sort(sections.begin(), sections.end(), [&](const auto& x, const auto& y){return x.base_address < y.base_address;});
-			for (int i = 0; i < sections.size()-1; ++i) {
+			for (size_t i = 0; i + 1 < sections.size(); ++i) {
 				if (sections[i].base_address + sections[i].length() > sections[i+1].base_address) {
 					ok = false;
 					char buf[256];
@@ -146,11 +151,169 @@ namespace masm::layt {
 		}
 
 	private:
+		// where out of line interrupt handlers have got up to, by the spill address they started at
+		std::map<uint32_t, uint32_t> spill_ends;
+
+		// Place .float sections, biggest first, each in the gap of its region that leaves the least
+		// space over once aligned (the lowest such gap on a tie). Sizes are measured by laying a
+		// section out with its own labels unknown, so every reference into it takes the long form;
+		// once placed it can only come out shorter, and is padded back to the measured size.
+		bool layout_floating(parser::pctx &pctx, std::vector<parser::section *> &floating) {
+			struct request {
+				parser::section *section;
+				uint64_t base, end, size;
+			};
+			std::vector<request> requests;
+			bool ok = true;
+
+			for (auto *section : floating) {
+				request r{section, 0, 0, 0};
+				try {
+					r.base = evalt.completely_evaluate<uint32_t>(section->float_base);
+					r.end = evalt.completely_evaluate<uint32_t>(section->float_end);
+				}
+				catch (std::domain_error &e) {
+					ok = false;
+					::report_error(pctx, section->progpos, std::string("invalid .float region: ") + e.what());
+					continue;
+				}
+
+				// laying out simplifies in place, so measure a copy
+				auto instructions = section->instructions;
+				sections.emplace_back();
+				current().index = section->index;
+				current().base_address = r.base;
+				bool measured = layout_section(pctx, instructions, false);
+				r.size = current().length();
+				sections.pop_back();
+				if (!measured) {
+					ok = false;
+					continue;
+				}
+				requests.push_back(r);
+			}
+
+			std::stable_sort(requests.begin(), requests.end(), [](const auto& x, const auto& y){return x.size > y.size;});
+
+			for (auto& r : requests) {
+				std::vector<std::pair<uint64_t, uint64_t>> used;
+				for (const auto& s : sections) used.emplace_back(s.base_address, s.base_address + s.length());
+				std::sort(used.begin(), used.end());
+
+				uint64_t align = r.section->align;
+				std::optional<uint64_t> best;
+				uint64_t best_slack = 0;
+				auto consider = [&](uint64_t from, uint64_t to) {
+					from = std::max(from, r.base);
+					to = std::min(to, r.end);
+					uint64_t at = (from + align - 1) & ~(align - 1);
+					if (at + r.size > to) return;
+					if (!best || to - at - r.size < best_slack) {
+						best = at;
+						best_slack = to - at - r.size;
+					}
+				};
+				uint64_t free = 0;
+				for (const auto& [begin, end] : used) {
+					if (begin > free) consider(free, begin);
+					free = std::max(free, end);
+				}
+				consider(free, (uint64_t)1 << 32);
+
+				if (!best) {
+					ok = false;
+					char buf[128];
+					snprintf(buf, sizeof buf, "no room for floating section of %llu bytes in 0x%08llx-0x%08llx", (unsigned long long)r.size, (unsigned long long)r.base, (unsigned long long)r.end);
+					::report_error(pctx, r.section->progpos, buf);
+					continue;
+				}
+
+				sections.emplace_back();
+				current().index = r.section->index;
+				current().base_address = *best;
+				r.section->starting_address = parser::expr((int64_t)*best);
+				ok &= layout_section(pctx, r.section->instructions);
+				if (size_t placed = current().length(); placed < r.size) {
+					current().contents.emplace_back();
+					currenti().type = concreteinsn::DATA;
+					currenti().d_data = parser::rawdata::make_span(std::vector<uint8_t>(r.size - placed));
+					currenti().progpos = r.section->progpos;
+				}
+			}
+			return ok;
+		}
+
+		// Layout instructions into the current section. Without define_labels the section's labels
+		// are left unknown, so nothing refers to where they happen to land.
+		bool layout_section(parser::pctx &pctx, std::vector<parser::insn> &instructions, bool define_labels = true) {
+			bool ok = true;
+			// Keep track of current address
+			uint32_t addr = current().base_address;
+
+			// Start parsing instructions
+			for (auto& insn : instructions) {
+				// Is this a label?
+				if (insn.type == parser::insn::LABEL) {
+					// Set the label's address
+					if (define_labels) evalt.define(insn.lbl, addr); // widening conversion works fine here
+				}
+				else {
+					try {
+						// Labels behind us have addresses now, so backward and same-section
+						// differences can fold to constants (and get short encodings)
+						evalt.simplify(insn);
+						// Otherwise, layout
+						layout_instruction(std::move(insn));
+						compile_instruction(currenti());
+					}
+					catch (std::domain_error &e) {
+						ok = false;
+						::report_error(pctx, insn.progpos, e.what());
+					}
+					// Increment counter
+					addr += currenti().length();
+				}
+			}
+			return ok;
+		}
+
+		// Layout an interrupt handler in its vector slot if it fits, otherwise after the other handlers
+		// that didn't fit, with the shortest jump to it in the slot.
+		bool layout_handler(parser::pctx &pctx, parser::section &section) {
+			// laying out simplifies in place, so keep the original around in case it has to move
+			auto instructions = section.instructions;
+			if (!layout_section(pctx, section.instructions)) return false;
+			if (current().length() <= parser::irq_slot) return true;
+
+			uint32_t slot = current().base_address;
+			uint32_t spill = evalt.completely_evaluate<uint32_t>(section.irq_spill);
+			auto [end, _] = spill_ends.try_emplace(spill, spill);
+
+			// Labels are redefined as the body is laid out again at its new address
+			current().contents.clear();
+			current().base_address = end->second;
+			if (!layout_section(pctx, instructions)) return false;
+			end->second += current().length();
+
+			parser::insn jump{parser::mov_insn(true, ""), parser::insn_arg{parser::expr((int64_t)current().base_address)}};
+			jump.progpos = current().contents.front().progpos;
+
+			sections.emplace_back();
+			current().index = section.index;
+			current().base_address = slot;
+			// a constant target with no condition, so this can't fail
+			layout_instruction(std::move(jump));
+			compile_instruction(currenti());
+			return true;
+		}
+
 		void layout_instruction(parser::insn &&insn) {
 			// Create a new instruction
 			current().contents.emplace_back();
 			// Forward position in source
 			currenti().progpos = insn.progpos;
+			currenti().bound = insn.bound;
+			currenti().is_call = insn.type == parser::insn::MOV && insn.i_mov.is_call;
 
 			// Forward data
 			if (insn.type == parser::insn::DATA) {
@@ -177,6 +340,7 @@ namespace masm::layt {
 						// If there is no index register, we should always use the simple mode as it gives more flexibility with the constant
 						if (insn.addr.reg_index == 0 && insn.addr.constant.type == parser::expr::num) {
 							currenti().i_subtype = concreteinsn::I_MSM;
+							currenti().missed = concreteinsn::MISS_WIDE;
 							currenti().ro = insn.addr.reg_base;
 							currenti().opcode = insn::build_load_store_opcode(
 								insn.i_ls.kind, insn.i_ls.size, insn.i_ls.dest, insn::load_store_address_mode::SIMPLE
@@ -194,6 +358,7 @@ namespace masm::layt {
 						}
 						else {
 							currenti().i_subtype = concreteinsn::I_SM;
+							if (insn.addr.reg_index == 0) currenti().missed = concreteinsn::MISS_SYMBOLIC;
 							currenti().ro = insn.addr.reg_base;
 							currenti().rs = insn.addr.reg_index;
 							currenti().opcode = insn::build_load_store_opcode(
@@ -247,6 +412,7 @@ namespace masm::layt {
 							// is this a register-register?
 							if (insn.args[2].mode == parser::insn_arg::REGISTER) {
 								currenti().i_subtype = concreteinsn::I_LONG;
+								currenti().missed = concreteinsn::MISS_RD_RS;
 								currenti().rs = insn.args[1].reg;
 								currenti().ro = insn.args[2].reg;
 								currenti().opcode = insn::build_alu_opcode(
@@ -256,6 +422,10 @@ namespace masm::layt {
 							// it's an immediate
 							else {
 								currenti().i_subtype = concreteinsn::I_MED;
+								currenti().missed =
+									insn.args[0].reg != insn.args[1].reg ? concreteinsn::MISS_RD_RS :
+									insn.args[2].constant.type != parser::expr::num ? concreteinsn::MISS_SYMBOLIC :
+									concreteinsn::MISS_WIDE;
 								currenti().ro = insn.args[1].reg;
 								currenti().imm = insn.args[2].constant;
 								currenti().opcode = insn::build_alu_opcode(
@@ -392,10 +562,12 @@ namespace masm::layt {
 								currenti().rd = insn.args[0].reg;
 								currenti().imm = insn.args[1].constant;
 								currenti().i_subtype = concreteinsn::I_BIG;
+								currenti().missed = insn.args[1].constant.type != parser::expr::num ? concreteinsn::MISS_SYMBOLIC : concreteinsn::MISS_WIDE;
 
 								// if the immediate certainly fits in a short encoding, use A
 								if (insn.args[1].constant.type == parser::expr::num && insn::fits(insn.args[1].constant.constant_value, 4)) {
 									currenti().i_subtype = concreteinsn::I_TINY;
+									currenti().missed = concreteinsn::MISS_NONE;
 								}
 							}
 							// Otherwise, use L encoding
@@ -460,10 +632,10 @@ namespace masm::layt {
 							// At this point, we know for a fact there are no constants involved (other than for +/-). Ensure there's a correspondence _somewhere_
 							else if (auto x = std::find_if(insn.args.begin() + 2, insn.args.end(), [&](const auto& y){return y.reg == insn.args[1].reg;}); x != insn.args.end()) {
 								bool pos = x == insn.args.begin() + 2; // true if LOP1/MRS
-								// Setup registers
+								// Setup registers (the moved one is whichever of the condition registers it matched)
 								currenti().rd = insn.args[0].reg;
-								currenti().rs = insn.args[1].reg;
-								currenti().ro = insn.args[2].reg;
+								currenti().rs = insn.args[2].reg;
+								currenti().ro = insn.args[3].reg;
 								// Calculate opcode
 								currenti().opcode = insn::build_mov_opcode(pos ? insn::mov_op::MRS : insn::mov_op::MRO, inscond);
 								// Setup size
@@ -486,6 +658,18 @@ namespace masm::layt {
 			}
 		}
 
+		// Lower whatever expressions the encoding needs, once, so assembling (and any later pass)
+		// only has to run them.
+		void compile_instruction(concreteinsn& ci) {
+			if (ci.type == concreteinsn::DATA && ci.d_data.type != parser::rawdata::SPAN) {
+				ci.low_code = evalt.compile(ci.d_data.low);
+				if (ci.d_data.type == parser::rawdata::BYTES) ci.high_code = evalt.compile(ci.d_data.high);
+			}
+			else if (ci.type == concreteinsn::INSN && ci.i_subtype != concreteinsn::I_SHORT) {
+				ci.imm_code = evalt.compile(ci.imm);
+			}
+		}
+
 		layoutsection& current() {
 			return sections.back();
 		}
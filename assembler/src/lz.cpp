@@ -0,0 +1,220 @@
+#include "lz.h"
+#include "dbg.h"
+#include "mcasm.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace masm::lz {
+	namespace {
+		constexpr size_t min_match = 3;
+		constexpr size_t max_match = 0x7f + min_match;
+		constexpr size_t max_literals = 0x80;
+		constexpr size_t max_offset = 0xffff;
+		// how many earlier positions with the same hash are tried for each match
+		constexpr size_t max_chain = 64;
+
+		// The expander, for the .lzunpack label. r1 walks the table (a count, then destination, length
+		// and source for each section), r3 is where the output has got to, r4 where it ends, r5 where
+		// the input has got to. Jumps are relative, so only the .org depends on where it goes.
+		constexpr const char *expander = R"(
+start:
+	add r1, pc, (table - start)
+	ld r2, [r1]
+	ld.h r2, [r1 + 2]
+	add r1, r1, 4
+	mov r9, 0x80
+next:
+	jmp.eq r14, r2, r0
+	ld r3, [r1]
+	ld.h r3, [r1 + 2]
+	ld r4, [r1 + 4]
+	ld.h r4, [r1 + 6]
+	ld r5, [r1 + 8]
+	ld.h r5, [r1 + 10]
+	add r1, r1, 12
+	add r4, r4, r3
+run:
+	jmp.le rel done, r4, r3
+	ld.b r6, [r5]
+	add r5, r5, 1
+	jmp.le rel match, r9, r6
+	add r6, r6, 1
+literal:
+	ld.b r7, [r5]
+	st.b.l r7, [r3]
+	add r5, r5, 1
+	add r3, r3, 1
+	sub r6, r6, 1
+	jmp.ne rel literal, r6, r0
+	jmp rel run
+match:
+	and r6, r6, 0x7f
+	add r6, r6, 3
+	ld.b r7, [r5]
+	ld.b r8, [r5 + 1]
+	lsl r8, r8, 8
+	or r7, r7, r8
+	add r5, r5, 2
+	sub r7, r3, r7
+copy:
+	ld.b r8, [r7]
+	st.b.l r8, [r3]
+	add r7, r7, 1
+	add r3, r3, 1
+	sub r6, r6, 1
+	jmp.ne rel copy, r6, r0
+	jmp rel run
+done:
+	sub r2, r2, 1
+	jmp rel next
+table:
+)";
+
+		uint32_t get32(const uint8_t *p) {
+			return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+
+		void put32(std::vector<uint8_t> &out, uint32_t v) {
+			for (int i = 0; i < 4; ++i) out.push_back((v >> (i * 8)) & 0xff);
+		}
+	}
+
+	std::vector<uint8_t> compress(const uint8_t *data, size_t length) {
+		std::vector<uint8_t> out;
+		std::vector<uint8_t> literals;
+
+		auto flush = [&]{
+			for (size_t i = 0; i < literals.size(); i += max_literals) {
+				size_t n = std::min(max_literals, literals.size() - i);
+				out.push_back(n - 1);
+				out.insert(out.end(), literals.begin() + i, literals.begin() + i + n);
+			}
+			literals.clear();
+		};
+
+		// most recent position for each hash of three bytes, and the one before each position
+		constexpr size_t hash_bits = 14;
+		std::vector<int64_t> head(1 << hash_bits, -1), prev(length, -1);
+		auto hash = [&](size_t i) {
+			uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+			return (v * 2654435761u) >> (32 - hash_bits);
+		};
+		auto insert = [&](size_t i) {
+			if (i + min_match > length) return;
+			auto& h = head[hash(i)];
+			prev[i] = h;
+			h = i;
+		};
+
+		for (size_t i = 0; i < length;) {
+			size_t best = 0, best_offset = 0;
+			if (i + min_match <= length) {
+				size_t limit = std::min(max_match, length - i);
+				size_t tries = 0;
+				for (int64_t c = head[hash(i)]; c >= 0 && i - c <= max_offset && tries < max_chain; c = prev[c], ++tries) {
+					size_t n = 0;
+					while (n < limit && data[c + n] == data[i + n]) ++n;
+					if (n > best) {
+						best = n;
+						best_offset = i - c;
+						if (n == limit) break;
+					}
+				}
+			}
+
+			if (best >= min_match) {
+				flush();
+				out.push_back(0x80 | (best - min_match));
+				out.push_back(best_offset & 0xff);
+				out.push_back(best_offset >> 8);
+				for (size_t j = 0; j < best; ++j) insert(i + j);
+				i += best;
+			}
+			else {
+				literals.push_back(data[i]);
+				insert(i);
+				++i;
+			}
+		}
+		flush();
+		return out;
+	}
+
+	bool pack(parser::pctx &pctx, const std::vector<const parser::section *> &owners, std::vector<uint8_t> &image, size_t *appended) {
+		struct record {
+			const parser::section *owner;
+			uint32_t base;
+			std::vector<uint8_t> data;
+		};
+		std::vector<record> records;
+		for (size_t ptr = 0, i = 0; ptr + 8 <= image.size() && i < owners.size(); ++i) {
+			uint32_t len = get32(&image[ptr + 4]);
+			records.push_back({owners[i], get32(&image[ptr]), std::vector<uint8_t>(&image[ptr + 8], &image[ptr + 8] + len)});
+			ptr += 8 + len;
+		}
+
+		auto unpack = std::find_if(records.begin(), records.end(), [](const auto& r){return r.owner->lzunpack;});
+		auto first = std::find_if(records.begin(), records.end(), [](const auto& r){return r.owner->compress;});
+		if (first == records.end() && unpack == records.end()) return true;
+		if (unpack == records.end()) {
+			::report_error(pctx, first->owner->progpos, "compressed section, but nothing is .lzunpack to expand it");
+			return false;
+		}
+
+		// the expander, assembled where it goes
+		uint32_t at = unpack->base + unpack->data.size();
+		if (at % 2) {
+			::report_error(pctx, unpack->owner->progpos, ".lzunpack has to be on a halfword");
+			return false;
+		}
+		auto code = masm::assemble(".org " + std::to_string(at) + "\n" + expander);
+		if (!code.ok) {
+			for (auto& d : code.diagnostics) pctx.diagnostics.push_back(std::move(d));
+			return false;
+		}
+		std::vector<uint8_t> blob(code.image.begin() + 8, code.image.end());
+
+		std::vector<const record *> packed;
+		for (const auto& r : records) {
+			if (r.owner->compress && !r.data.empty()) packed.push_back(&r);
+		}
+
+		// table, then each section's compressed data in the same order
+		std::vector<std::vector<uint8_t>> payloads;
+		for (const auto *r : packed) payloads.push_back(compress(r->data.data(), r->data.size()));
+		uint32_t src = at + blob.size() + 4 + 12 * packed.size();
+		put32(blob, packed.size());
+		for (size_t i = 0; i < packed.size(); ++i) {
+			put32(blob, packed[i]->base);
+			put32(blob, packed[i]->data.size());
+			put32(blob, src);
+			src += payloads[i].size();
+		}
+		for (const auto& p : payloads) blob.insert(blob.end(), p.begin(), p.end());
+		unpack->data.insert(unpack->data.end(), blob.begin(), blob.end());
+		if (appended) *appended = blob.size();
+
+		// compressed sections count at where they're expanded to, as the expander would write over
+		// itself or its input there
+		uint64_t begin = unpack->base, end = begin + unpack->data.size();
+		for (const auto& r : records) {
+			if (&r == &*unpack || r.data.empty()) continue;
+			if (r.base < end && begin < (uint64_t)r.base + r.data.size()) {
+				char buf[160];
+				snprintf(buf, sizeof buf, "expander and compressed data (0x%08x-0x%08x) overlap the %ssection at 0x%08x", (uint32_t)begin, (uint32_t)end, r.owner->compress ? "compressed " : "", r.base);
+				::report_error(pctx, unpack->owner->progpos, buf);
+				return false;
+			}
+		}
+
+		image.clear();
+		for (const auto& r : records) {
+			if (r.owner->compress) continue;
+			put32(image, r.base);
+			put32(image, r.data.size());
+			image.insert(image.end(), r.data.begin(), r.data.end());
+		}
+		return true;
+	}
+}
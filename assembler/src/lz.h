@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <parser.h>
+
+namespace masm::lz {
+	// Compression for .compress sections. The stream is a series of runs, each starting with a
+	// control byte c:
+	//
+	//  - c < 0x80: c + 1 literal bytes follow
+	//  - otherwise: copy (c & 0x7f) + 3 bytes from offset bytes back in the output, where offset is
+	//    the little endian halfword that follows (1 to 65535)
+	//
+	// There's no end marker, the expander is told how long the output is.
+	std::vector<uint8_t> compress(const uint8_t *data, size_t length);
+
+	// Pack an assembled image, given the section each of its records came from (in order): every
+	// .compress section is taken out of the image and compressed, and the expander routine, a
+	// table of what to expand where, and the compressed data are put on the end of the .lzunpack
+	// section. A call to its label then expands everything into place, clobbering r1-r9, and
+	// returns through r14.
+	//
+	// Returns false (with diagnostics in pctx) if there's no .lzunpack for compressed sections, or
+	// what it adds runs into another section or a compressed section's destination. The number of
+	// bytes added to the .lzunpack section goes in appended, if given.
+	bool pack(parser::pctx &pctx, const std::vector<const parser::section *> &owners, std::vector<uint8_t> &image, size_t *appended = nullptr);
+}
@@ -1,18 +1,133 @@
-#include "insns.h"
-#include <parser.h>
 #include <iostream>
 #include <fstream>
-#include "dbg.h"
-#include "eval.h"
-#include "layt.h"
-#include "assmbl.h"
+#include "imgfmt.h"
+#include "mcasm.h"
+#include "wcet.h"
 
-static constexpr inline bool DebugPrint = false;
+// Escape a path for a make-style depfile
+static std::string depfile_escape(const std::string& path) {
+	std::string result;
+	for (char c : path) {
+		if (c == ' ' || c == '#' || c == '\\') result.push_back('\\');
+		else if (c == '$') result.push_back('$');
+		result.push_back(c);
+	}
+	return result;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: mcasm [-I DIR]... [-j THREADS] [--depfile FILE] [--thread-jumps] [--gc-sections] [--keep LABEL]... [--map FILE] [--paged] [--readmemh FILE] [--readmemh-base ADDR] [--wcet] [--wcet-costs FILE] [--stats] INPUT OUTPUT\n");
+}
 
 int main(int argc, char ** argv) {
 	std::string f_data;
-	std::string f_name = argv[1];
-	std::string f_out  = argv[2];
+	std::string f_name, f_out;
+	std::vector<std::string> include_dirs;
+	unsigned threads = 0;
+	bool thread_jumps = false;
+	bool gc_sections = false;
+	std::vector<std::string> keep;
+	std::string f_depfile, f_map;
+
+	// output formats
+	bool paged = false;
+	std::string f_readmemh;
+	uint32_t readmemh_base = 0;
+
+	// reports
+	bool stats = false;
+
+	// worst-case cycle analysis
+	bool wcet = false;
+	std::string f_costs;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if (arg == "-I") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			include_dirs.push_back(argv[++i]);
+		}
+		else if (arg == "-j") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			threads = strtoul(argv[++i], nullptr, 0);
+		}
+		else if (arg == "--depfile") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			f_depfile = argv[++i];
+		}
+		else if (arg == "--map") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			f_map = argv[++i];
+		}
+		else if (arg == "--paged") paged = true;
+		else if (arg == "--readmemh") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			f_readmemh = argv[++i];
+		}
+		else if (arg == "--readmemh-base") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			readmemh_base = strtoul(argv[++i], nullptr, 0);
+		}
+		else if (arg == "--thread-jumps") thread_jumps = true;
+		else if (arg == "--gc-sections") gc_sections = true;
+		else if (arg == "--keep") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			keep.push_back(argv[++i]);
+		}
+		else if (arg == "--stats") stats = true;
+		else if (arg == "--wcet") wcet = true;
+		else if (arg == "--wcet-costs") {
+			if (i + 1 >= argc) {
+				usage();
+				return -1;
+			}
+			wcet = true;
+			f_costs = argv[++i];
+		}
+		else if (f_name.empty() && arg[0] != '-') f_name = arg;
+		else if (f_out.empty() && arg[0] != '-') f_out = arg;
+		else {
+			usage();
+			return -1;
+		}
+	}
+	if (f_out.empty()) {
+		usage();
+		return -1;
+	}
+
+	masm::wcet::costs costs;
+	if (!f_costs.empty()) {
+		try {
+			costs.load(f_costs);
+		}
+		catch (const std::runtime_error& e) {
+			fprintf(stderr, "mcasm: %s\n", e.what());
+			return -1;
+		}
+	}
 
 	{
 		std::ifstream f_in(f_name);
@@ -22,72 +137,45 @@ int main(int argc, char ** argv) {
 		f_in.read(f_data.data(), f_data.size());
 	}
 
-	// parse
-	
-	masm::parser::pctx pctx;
-	auto parser = yy::mcasm_parser(pctx);
+	masm::options opts;
+	opts.filename = f_name;
+	opts.include_dirs = std::move(include_dirs);
+	opts.threads = threads;
+	opts.thread_jumps = thread_jumps;
+	opts.gc_sections = gc_sections;
+	opts.keep = std::move(keep);
+	if (wcet) opts.wcet = &costs;
+	opts.map = !f_map.empty();
+	opts.stats = stats;
 
-	pctx.prepare_cursor(f_data.data());
-	if (pctx.lineoffsets.empty()) {
-		fprintf(stderr, "mcasm: empty input");
-		return -1;
-	}
-	pctx.loc.begin.filename = &f_name;
-	pctx.loc.end.filename = &f_name;
+	auto result = masm::assemble(f_data, opts);
+	for (const auto& d : result.diagnostics) masm::print(std::cerr, d, f_data);
+	if (!result.ok) return 1;
 
-	if (parser.parse() || is_error_reported_yet) {
-		return 1;
-	}
+	std::cout << result.wcet_report;
+	std::cout << result.stats_report;
 
-	// DEBUG: dump insn
-	if (DebugPrint) std::cout << pctx;
-
-	masm::eval::evaluator eval;
-
-	// simplify expressions
-	for (auto& section : pctx.sections) {
-		for (auto& insn : section.instructions) {
-			switch (insn.type) {
-				case masm::parser::insn::LOADSTORE:
-					eval.simplify(insn.addr.constant);
-					[[fallthrough]];
-				case masm::parser::insn::ALU:
-				case masm::parser::insn::MOV:
-					for (auto& arg : insn.args) {
-						switch (arg.mode) {
-							case masm::parser::insn_arg::CONSTANT:
-							case masm::parser::insn_arg::REGISTER_PLUS:
-								// simplify + process
-								eval.simplify(arg.constant);
-							default:
-								break;
-						}
-					}
-					break;
-				case masm::parser::insn::DATA:
-					eval.simplify(insn.raw.low);
-					if (insn.raw.type == masm::parser::rawdata::BYTES) {
-						eval.simplify(insn.raw.high);
-					}
-				default:
-					break;
-			}
-		}
+	if (!f_readmemh.empty()) {
+		std::ofstream memout(f_readmemh, std::ios::out | std::ios::trunc);
+		masm::imgfmt::write_readmemh(result.image, readmemh_base, memout);
 	}
 
-	// show evaluated debug
-	if (DebugPrint) std::cout << "after eval:\n" << pctx << "\n";
-	
-	// layout memory / pick opcodes
-	masm::layt::lctx layout(eval);
-	// do layout
-	if (!layout.layout_from(pctx) || is_error_reported_yet) return 2;
-	if (DebugPrint) std::cout << "after layout:\n" << layout << "\n";
-
 	// write to binary
+	if (paged) result.image = masm::imgfmt::to_paged(result.image);
 	std::ofstream binout(f_out, std::ios::out | std::ios::binary | std::ios::trunc);
+	binout.write(reinterpret_cast<const char *>(result.image.data()), result.image.size());
 
-	// do assembling
-	masm::assmbl::assemble(pctx, std::move(layout), binout);
+	if (!f_map.empty()) {
+		std::ofstream mapout(f_map, std::ios::out | std::ios::trunc);
+		mapout << result.map;
+	}
+
+	// list what went into the output, for the build system
+	if (!f_depfile.empty()) {
+		std::ofstream depout(f_depfile, std::ios::out | std::ios::trunc);
+		depout << depfile_escape(f_out) << ": " << depfile_escape(f_name);
+		for (const auto& dep : result.dependencies) depout << " \\\n  " << depfile_escape(dep);
+		depout << "\n";
+	}
 	return 0;
 }
@@ -0,0 +1,192 @@
+#include "mcasm.h"
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include "dbg.h"
+#include "eval.h"
+#include "layt.h"
+#include "lz.h"
+#include "assmbl.h"
+#include "opt.h"
+#include "pool.h"
+#include "stats.h"
+#include "wcet.h"
+
+static constexpr inline bool DebugPrint = false;
+
+// instructions simplified per unit of work; small programs never start any threads
+static constexpr inline size_t simplify_chunk = 256;
+
+namespace masm {
+	namespace {
+		// where a section was laid out, which is all the map needs once the layout is assembled
+		struct placed {
+			size_t index;
+			uint32_t base_address;
+			size_t length;
+		};
+
+		// One line per laid out section in address order: where it is, how big, whether it was
+		// placed by .float (and in what region), the first label it defines and where it starts.
+		void write_map(parser::pctx &pctx, const std::vector<placed> &layout, eval::evaluator &eval, std::ostream &os) {
+			std::map<parser::labelname, std::string_view> names;
+			for (const auto& [lbl, id] : pctx.named_labels) names.emplace(lbl, pctx.idents.name(id));
+			// by index rather than position, as --gc-sections may have dropped some
+			std::map<size_t, const parser::section *> by_index;
+			for (const auto& section : pctx.sections) by_index.emplace(section.index, &section);
+
+			char buf[128];
+			for (const auto& ls : layout) {
+				auto& section = *by_index.at(ls.index);
+				size_t length = ls.length;
+				snprintf(buf, sizeof buf, "%08x-%08x %6zu  ", ls.base_address, (uint32_t)(ls.base_address + length), length);
+				os << buf;
+				if (section.floating) {
+					auto base = section.float_base, end = section.float_end;
+					snprintf(buf, sizeof buf, "float %08x-%08x align %-4u",
+						eval.completely_evaluate<uint32_t>(base), eval.completely_evaluate<uint32_t>(end), (unsigned)section.align);
+					os << buf;
+				}
+				else os << std::left << std::setw(34) << (section.irq >= 0 ? "irq " + std::to_string(section.irq) : std::string("fixed")) << std::right;
+
+				std::string_view name = "-";
+				for (const auto& insn : section.instructions) {
+					if (insn.type != parser::insn::LABEL) continue;
+					if (auto it = names.find(insn.lbl); it != names.end()) {
+						name = it->second;
+						break;
+					}
+				}
+				os << ' ' << name << "  " << (section.progpos.begin.filename ? *section.progpos.begin.filename : std::string("(input)")) << ':' << section.progpos.begin.line << '\n';
+			}
+		}
+	}
+
+	result assemble(std::string_view source, const options& opts) {
+		result r;
+		// the lexer relies on a NUL at the end
+		std::string text(source);
+
+		// parse
+
+		parser::pctx pctx;
+		pctx.include_dirs = opts.include_dirs;
+		auto parser = yy::mcasm_parser(pctx);
+
+		pctx.prepare_cursor(text.c_str());
+		pctx.loc.begin.filename = &opts.filename;
+		pctx.loc.end.filename = &opts.filename;
+
+		auto finish = [&]{
+			r.ok = pctx.diagnostics.empty();
+			r.diagnostics = std::move(pctx.diagnostics);
+			r.dependencies = std::move(pctx.dependencies);
+			if (!r.ok) r.image.clear();
+			return std::move(r);
+		};
+
+		if (parser.parse() || !pctx.diagnostics.empty()) return finish();
+
+		// DEBUG: dump insn
+		if (DebugPrint) std::cout << pctx;
+
+		eval::evaluator eval;
+
+		// simplify expressions, which only reads the evaluator and writes the one instruction, so
+		// big programs are split across threads
+		std::vector<parser::insn *> insns;
+		for (auto& section : pctx.sections) {
+			for (auto& insn : section.instructions) insns.push_back(&insn);
+		}
+		pool::for_each(insns.size(), simplify_chunk, opts.threads, [&](size_t i){
+			eval.simplify(*insns[i]);
+		});
+
+		// turn muli/divi into cheaper instructions where there are some
+		opt::reduce_strength(pctx, opts.wcet ? *opts.wcet : wcet::costs{});
+
+		// optionally collapse chains of jumps
+		if (opts.thread_jumps) opt::thread_jumps(pctx);
+
+		// optionally drop unreferenced sections
+		if (opts.gc_sections) {
+			opt::gc_sections(pctx, opts.keep);
+			if (!pctx.diagnostics.empty()) return finish();
+		}
+
+		// show evaluated debug
+		if (DebugPrint) std::cout << "after eval:\n" << pctx << "\n";
+
+		// layout memory / pick opcodes
+		layt::lctx layout(eval);
+		// do layout
+		if (!layout.layout_from(pctx) || !pctx.diagnostics.empty()) return finish();
+		if (DebugPrint) std::cout << "after layout:\n" << layout << "\n";
+
+		if (opts.wcet) {
+			std::ostringstream report;
+			wcet::report(pctx, layout, *opts.wcet, report);
+			r.wcet_report = report.str();
+		}
+
+		if (opts.stats) {
+			std::ostringstream report;
+			stats::report(pctx, layout, text, report);
+			r.stats_report = report.str();
+		}
+
+		// the section each record of the image comes from, for packing, and where they went
+		std::map<size_t, const parser::section *> by_index;
+		for (const auto& section : pctx.sections) by_index.emplace(section.index, &section);
+		std::vector<const parser::section *> owners;
+		std::vector<placed> sections;
+		for (const auto& ls : layout.sections) {
+			owners.push_back(by_index.at(ls.index));
+			sections.push_back({ls.index, ls.base_address, ls.length()});
+		}
+
+		// do assembling
+		assmbl::assemble(pctx, std::move(layout), r.image);
+		size_t appended = 0;
+		if (pctx.diagnostics.empty()) lz::pack(pctx, owners, r.image, &appended);
+
+		// after packing, so the .lzunpack section includes the expander and compressed data
+		if (opts.map) {
+			for (size_t i = 0; i < sections.size(); ++i) {
+				if (owners[i]->lzunpack) sections[i].length += appended;
+			}
+			std::ostringstream map;
+			write_map(pctx, sections, eval, map);
+			r.map = map.str();
+		}
+		return finish();
+	}
+
+	void print(std::ostream& os, const diagnostic& d, std::string_view source) {
+		if (d.file.empty()) {
+			os << "mcasm: " << d.message << '\n';
+			return;
+		}
+		os << d.file << ':' << d.line << ':' << d.column << '-' << d.end_column << ": " << d.message << '\n';
+
+		// Find the line, if it's there
+		if (d.line < 1) return;
+		size_t begin = 0;
+		for (int line = 1; line < d.line; ++line) {
+			begin = source.find('\n', begin);
+			if (begin == std::string_view::npos) return;
+			++begin;
+		}
+		size_t end = std::min(source.find('\n', begin), source.size());
+
+		os << std::setw(6) << std::right << d.line << " | " << source.substr(begin, end - begin) << "\n         ";
+		for (int i = 0; i < d.column - 1; ++i) {
+			os << ' ';
+		}
+		for (int i = 0; i < d.end_column - d.column; ++i) {
+			os << (i == 0 ? '^' : '~');
+		}
+		os << "\n";
+	}
+}
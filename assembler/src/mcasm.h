@@ -0,0 +1,58 @@
+#pragma once
+
+// Assembler library: everything mcasm does, from source text in memory to an image in memory.
+// Nothing is shared between calls, so it can be used from as many threads as needed.
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "diagnostic.h"
+
+namespace masm {
+	namespace wcet {
+		struct costs;
+	}
+
+	struct options {
+		// used in diagnostics, and its directory is searched for .incbin files
+		std::string filename = "(input)";
+		// searched for .incbin files after that
+		std::vector<std::string> include_dirs;
+		// threads for the stages that can use them (0 for one per core)
+		unsigned threads = 0;
+		// run jump threading (see opt.h)
+		bool thread_jumps = false;
+		// drop sections nothing refers to, keeping those defining these labels (see opt.h)
+		bool gc_sections = false;
+		std::vector<std::string> keep;
+		// if set, do the worst-case cycle analysis with these costs (see wcet.h)
+		const wcet::costs *wcet = nullptr;
+		// list where every section ended up, in result::map
+		bool map = false;
+		// report how densely the code is encoded, in result::stats_report (see stats.h)
+		bool stats = false;
+	};
+
+	struct result {
+		// no errors, and image is complete
+		bool ok = false;
+		// sections, each as address, length then contents (all little endian)
+		std::vector<uint8_t> image;
+		std::vector<diagnostic> diagnostics;
+		// files read by .incbin
+		std::vector<std::string> dependencies;
+		// from options::wcet
+		std::string wcet_report;
+		// from options::map
+		std::string map;
+		// from options::stats
+		std::string stats_report;
+	};
+
+	result assemble(std::string_view source, const options& opts = {});
+
+	// Write out a diagnostic like mcasm does, quoting the line it's about from source
+	void print(std::ostream& os, const diagnostic& d, std::string_view source);
+}
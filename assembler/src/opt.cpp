@@ -0,0 +1,483 @@
+#include "opt.h"
+#include "eval.h"
+#include <bit>
+#include <map>
+#include <optional>
+#include <set>
+
+namespace masm::opt {
+	namespace {
+		bool is_unconditional_jump(const parser::insn &i) {
+			return i.type == parser::insn::MOV && i.i_mov.is_jmp && i.i_mov.condition == parser::mov_insn::AL;
+		}
+
+		// a jmp to somewhere fixed (a label, a constant or some sum of them)
+		bool has_fixed_target(const parser::insn &i) {
+			return i.type == parser::insn::MOV && i.i_mov.is_jmp && i.args[0].mode == parser::insn_arg::CONSTANT;
+		}
+
+		bool is_direct_jump(const parser::insn &i) {
+			return is_unconditional_jump(i) && has_fixed_target(i);
+		}
+
+		using sequence = std::vector<parser::insn>;
+
+		// What a sequence costs, cycles first and then bytes
+		struct cost {
+			uint64_t cycles = 0, bytes = 0;
+
+			auto operator<=>(const cost&) const = default;
+		};
+
+		// The encoding layout picks for the kinds of instruction built here
+		insn::format::e format_of(const parser::insn &i) {
+			if (i.type == parser::insn::ALU) {
+				const auto& op2 = i.args[2];
+				bool same = i.args[0].reg == i.args[1].reg;
+				switch (op2.mode) {
+					case parser::insn_arg::REGISTER: return same ? insn::format::S : insn::format::L;
+					case parser::insn_arg::CONSTANT: return same && insn::fits(op2.constant.constant_value, 4) ? insn::format::A : insn::format::M;
+					default:                         return insn::format::T;
+				}
+			}
+			if (i.args.size() > 2) return insn::format::T;
+			if (i.args[1].mode == parser::insn_arg::REGISTER) return insn::format::S;
+			return insn::fits(i.args[1].constant.constant_value, 4) ? insn::format::A : insn::format::B;
+		}
+
+		cost cost_of(const sequence &seq, const wcet::costs &costs) {
+			cost total;
+			for (const auto& i : seq) {
+				auto fmt = format_of(i);
+				total.cycles += costs.encoding[fmt];
+				if (i.type == parser::insn::ALU && (i.i_alu == insn::alu_op::DIV || i.i_alu == insn::alu_op::MOD)) total.cycles += costs.divide;
+				total.bytes += fmt == insn::format::S || fmt == insn::format::A ? 2 : 4;
+			}
+			return total;
+		}
+
+		parser::insn alu(insn::alu_op::e op, uint32_t rd, uint32_t rs, parser::insn_arg &&op2) {
+			return parser::insn{op, parser::insn_arg{rd}, parser::insn_arg{rs}, std::move(op2)};
+		}
+
+		parser::insn_arg imm(int64_t value) {
+			return parser::insn_arg{parser::expr{value}};
+		}
+
+		parser::insn_arg shifted(uint32_t reg, uint8_t shift) {
+			return shift ? parser::insn_arg{reg, parser::insn_arg::REGISTER_LSHIFT, shift} : parser::insn_arg{reg};
+		}
+
+		// rd = rs, which is nothing at all if they're the same register
+		sequence copy(uint32_t rd, uint32_t rs) {
+			sequence seq;
+			if (rd != rs) seq.push_back(parser::insn{parser::mov_insn{false, ""}, parser::insn_arg{rd}, parser::insn_arg{rs}});
+			return seq;
+		}
+
+		struct reducer {
+			uint32_t rd, rs;
+			const wcet::costs &costs;
+
+			std::optional<sequence> best;
+			cost best_cost;
+
+			reducer(uint32_t rd, uint32_t rs, const wcet::costs &costs) : rd(rd), rs(rs), costs(costs) {}
+
+			void consider(sequence &&seq) {
+				auto c = cost_of(seq, costs);
+				if (best && !(c < best_cost)) return;
+				best = std::move(seq);
+				best_cost = c;
+			}
+
+			// Cheapest way to get rd = rs * factor in at most depth add/sub/lsl instructions, building
+			// on a smaller factor already in rd each time. rs is clobbered after the first instruction
+			// if it's also rd, so only then can it be used again. Once search_limit factors have been
+			// worked out, the search stops trying new ones and makes do with what it has.
+			using memo = std::map<std::pair<uint32_t, int>, std::optional<sequence>>;
+			static constexpr size_t search_limit = 128;
+
+			static std::optional<sequence> multiply(uint32_t rd, uint32_t rs, uint32_t factor, int depth, const wcet::costs &costs, memo &seen) {
+				if (auto it = seen.find({factor, depth}); it != seen.end()) return it->second;
+				reducer r{rd, rs, costs};
+
+				// straight from rs
+				if (factor == 1) r.consider(copy(rd, rs));
+				if (factor == 0) r.consider({parser::insn{parser::mov_insn{false, ""}, parser::insn_arg{rd}, imm(0)}});
+				if (std::has_single_bit(factor) && factor != 1) r.consider({alu(insn::alu_op::LSL, rd, rs, imm(std::countr_zero(factor)))});
+				for (uint8_t k = 1; k <= 4; ++k) {
+					if (factor == 1 + (1u << k)) r.consider({alu(insn::alu_op::ADD, rd, rs, shifted(rs, k))});
+					if (factor == 1 - (1u << k)) r.consider({alu(insn::alu_op::SUB, rd, rs, shifted(rs, k))});
+				}
+				for (uint8_t k = 0; k <= 4; ++k) {
+					if (factor == -(1u << k)) r.consider({alu(insn::alu_op::SUB, rd, 0, shifted(rs, k))});
+				}
+				if (depth <= 1) return seen[{factor, depth}] = std::move(r.best);
+
+				// or one more instruction on top of a smaller factor
+				auto extend = [&](uint32_t from, parser::insn &&last) {
+					if (from == factor || (seen.size() >= search_limit && !seen.count({from, depth - 1}))) return;
+					if (auto seq = multiply(rd, rs, from, depth - 1, costs, seen)) {
+						seq->push_back(std::move(last));
+						r.consider(std::move(*seq));
+					}
+				};
+
+				if (factor && !(factor & 1)) extend(factor >> std::countr_zero(factor), alu(insn::alu_op::LSL, rd, rd, imm(std::countr_zero(factor))));
+				int64_t signed_factor = (int32_t)factor;
+				for (uint8_t k = 1; k <= 4; ++k) {
+					if (signed_factor % (1 + (1 << k)) == 0) extend(signed_factor / (1 + (1 << k)), alu(insn::alu_op::ADD, rd, rd, shifted(rd, k)));
+					if (signed_factor % (1 - (1 << k)) == 0) extend(signed_factor / (1 - (1 << k)), alu(insn::alu_op::SUB, rd, rd, shifted(rd, k)));
+				}
+				if (rd != rs) {
+					for (uint8_t k = 0; k <= 4; ++k) {
+						extend(factor - (1u << k), alu(insn::alu_op::ADD, rd, rd, shifted(rs, k)));
+						extend(factor + (1u << k), alu(insn::alu_op::SUB, rd, rd, shifted(rs, k)));
+					}
+				}
+				extend(-factor, alu(insn::alu_op::SUB, rd, 0, parser::insn_arg{rd}));
+
+				return seen[{factor, depth}] = std::move(r.best);
+			}
+
+			// Any factor, as long as rs survives: go through its signed binary digits from the top,
+			// shifting rd along and adding or subtracting rs for each one that isn't zero
+			static sequence horner(uint32_t rd, uint32_t rs, uint32_t factor) {
+				// (bit, negative), lowest first; digits past bit 31 drop out of a 32-bit product
+				std::vector<std::pair<int, bool>> digits;
+				uint64_t f = factor;
+				for (int bit = 0; f && bit < 32; ++bit, f >>= 1) {
+					if (!(f & 1)) continue;
+					bool negative = (f & 3) == 3;
+					digits.emplace_back(bit, negative);
+					f = negative ? f + 1 : f - 1;
+				}
+
+				// a leading +1 is just rs, so the first step can read it from there
+				auto digit = digits.rbegin();
+				sequence seq;
+				if (digit->second) seq.push_back(alu(insn::alu_op::SUB, rd, 0, parser::insn_arg{rs}));
+				uint32_t src = digit->second ? rd : rs;
+				int at = digit->first;
+				for (++digit; digit != digits.rend(); ++digit) {
+					int shift = at - digit->first;
+					if (!digit->second && shift <= 4) seq.push_back(alu(insn::alu_op::ADD, rd, rs, shifted(src, shift)));
+					else {
+						seq.push_back(alu(insn::alu_op::LSL, rd, src, imm(shift)));
+						seq.push_back(alu(digit->second ? insn::alu_op::SUB : insn::alu_op::ADD, rd, rd, parser::insn_arg{rs}));
+					}
+					src = rd;
+					at = digit->first;
+				}
+				if (at) seq.push_back(alu(insn::alu_op::LSL, rd, src, imm(at)));
+				else if (src != rd) return copy(rd, rs);
+				return seq;
+			}
+
+			// Any constant with rd free: load it into rd and do op with it, building constants too wide
+			// for a mov from their top 20 bits
+			static sequence load_and(insn::alu_op::e op, uint32_t rd, uint32_t rs, uint32_t constant) {
+				sequence seq;
+				if (insn::fits(constant, 20)) seq.push_back(parser::insn{parser::mov_insn{false, ""}, parser::insn_arg{rd}, imm((int32_t)constant)});
+				else {
+					seq.push_back(parser::insn{parser::mov_insn{false, ""}, parser::insn_arg{rd}, imm((int32_t)constant >> 12)});
+					seq.push_back(alu(insn::alu_op::LSL, rd, rd, imm(12)));
+					if (constant & 0xfff) seq.push_back(alu(insn::alu_op::OR, rd, rd, imm(constant & 0xfff)));
+				}
+				seq.push_back(alu(op, rd, rs, parser::insn_arg{rd}));
+				return seq;
+			}
+
+			// The cheapest of the above for rd = rs * factor
+			void product(uint32_t factor) {
+				memo seen;
+				if (auto seq = multiply(rd, rs, factor, 5, costs, seen)) consider(std::move(*seq));
+				if (rd != rs && factor) consider(horner(rd, rs, factor));
+				if (rd != rs && !insn::fits(factor, 16)) consider(load_and(insn::alu_op::MUL, rd, rs, factor));
+			}
+
+			// Ways to get rd = rs / 2^shift, rounding towards zero: negative dividends need 2^shift - 1
+			// adding first.
+			void divide(uint32_t shift) {
+				if (!shift) {
+					consider(copy(rd, rs));
+					return;
+				}
+
+				// a conditional mov adds the correction without needing another register, but only up to
+				// what fits in its immediate, so bigger shifts go in steps (truncating each time gives the
+				// same result)
+				sequence seq = copy(rd, rs);
+				for (uint32_t left = shift; left; ) {
+					uint32_t step = std::min(left, 9u);
+					seq.push_back(parser::insn{parser::mov_insn{false, "slt"}, parser::insn_arg{rd},
+						parser::insn_arg{rd, parser::expr{(int64_t)(1 << step) - 1}}, parser::insn_arg{rd}, parser::insn_arg{0u}});
+					seq.push_back(alu(insn::alu_op::SR, rd, rd, imm(step)));
+					left -= step;
+				}
+				consider(std::move(seq));
+
+				// with rd free, the correction can be made from the sign bits instead
+				if (rd != rs) {
+					consider({
+						alu(insn::alu_op::SR, rd, rs, imm(31)),
+						alu(insn::alu_op::LSR, rd, rd, imm(32 - shift)),
+						alu(insn::alu_op::ADD, rd, rd, parser::insn_arg{rs}),
+						alu(insn::alu_op::SR, rd, rd, imm(shift))
+					});
+				}
+			}
+		};
+	}
+
+	size_t thread_jumps(parser::pctx &pctx) {
+		size_t changed = 0;
+
+		// Where each label is
+		std::map<parser::labelname, std::pair<size_t, size_t>> labels;
+		auto find_labels = [&]{
+			labels.clear();
+			for (size_t s = 0; s < pctx.sections.size(); ++s) {
+				const auto& instructions = pctx.sections[s].instructions;
+				for (size_t i = 0; i < instructions.size(); ++i) {
+					if (instructions[i].type == parser::insn::LABEL) labels[instructions[i].lbl] = std::pair{s, i};
+				}
+			}
+		};
+		find_labels();
+
+		// First instruction at or after i that isn't a label
+		auto skip_labels = [&](size_t s, size_t i){
+			const auto& instructions = pctx.sections[s].instructions;
+			while (i < instructions.size() && instructions[i].type == parser::insn::LABEL) ++i;
+			return i;
+		};
+
+		// The (section, index) a jump to expr lands on, if it's a plain label
+		auto landing = [&](const parser::expr &target) -> std::optional<std::pair<size_t, size_t>> {
+			if (target.type != parser::expr::label) return std::nullopt;
+			auto it = labels.find(target.label_value);
+			if (it == labels.end()) return std::nullopt;
+			return std::pair{it->second.first, skip_labels(it->second.first, it->second.second)};
+		};
+
+		// Thread chains of jumps (conditional ones can be pointed further along too)
+		for (auto& section : pctx.sections) {
+			for (auto& insn : section.instructions) {
+				if (!has_fixed_target(insn)) continue;
+
+				const parser::expr *target = &insn.args[0].constant;
+				std::set<std::pair<size_t, size_t>> seen;
+				while (auto at = landing(*target)) {
+					const auto& instructions = pctx.sections[at->first].instructions;
+					if (at->second == instructions.size() || !is_direct_jump(instructions[at->second])) break;
+					// a loop of jumps never gets anywhere, so leave it be
+					if (!seen.insert(*at).second) break;
+					target = &instructions[at->second].args[0].constant;
+				}
+
+				if (target != &insn.args[0].constant) {
+					insn.args[0].constant = parser::expr(*target);
+					++changed;
+				}
+			}
+		}
+
+		// Remove jumps to the next instruction, and whatever can't be reached after a jmp to a label
+		// (a computed jump or a call can come back to what follows). Removing either can leave
+		// another jump landing on the next instruction, so go until nothing changes.
+		for (bool removed = true; removed; ) {
+			removed = false;
+			for (size_t s = 0; s < pctx.sections.size(); ++s) {
+				auto& instructions = pctx.sections[s].instructions;
+				std::vector<bool> remove(instructions.size(), false);
+
+				for (size_t i = 0; i < instructions.size(); ++i) {
+					const auto& insn = instructions[i];
+					if (!is_direct_jump(insn) || insn.i_mov.is_call) continue;
+					auto at = landing(insn.args[0].constant);
+					if (at && at->first == s && at->second == skip_labels(s, i + 1)) remove[i] = true;
+				}
+
+				bool reachable = true;
+				for (size_t i = 0; i < instructions.size(); ++i) {
+					const auto& insn = instructions[i];
+					if (insn.type == parser::insn::LABEL || insn.type == parser::insn::DATA) reachable = true;
+					else if (!reachable) remove[i] = true;
+					else if (!remove[i] && is_direct_jump(insn) && !insn.i_mov.is_call) reachable = false;
+				}
+
+				size_t kept = 0;
+				for (size_t i = 0; i < instructions.size(); ++i) {
+					if (remove[i]) continue;
+					if (kept != i) instructions[kept] = std::move(instructions[i]);
+					++kept;
+				}
+				if (kept == instructions.size()) continue;
+				changed += instructions.size() - kept;
+				instructions.resize(kept);
+				removed = true;
+			}
+			if (removed) find_labels();
+		}
+
+		return changed;
+	}
+
+	size_t reduce_strength(parser::pctx &pctx, const wcet::costs &costs) {
+		size_t changed = 0;
+		// the sequence picked for each (factor, rd == rs), worked out for r1 = r2 * factor (or r1
+		// = r1 * factor) and renamed for each use, as the search is the slow part
+		std::map<std::pair<uint32_t, bool>, std::optional<sequence>> products;
+
+		for (auto& section : pctx.sections) {
+			sequence result;
+			result.reserve(section.instructions.size());
+
+			for (auto& i : section.instructions) {
+				if (!i.reduce || i.args[2].constant.type != parser::expr::num) {
+					result.push_back(std::move(i));
+					continue;
+				}
+
+				uint32_t rd = i.args[0].reg, rs = i.args[1].reg;
+				uint32_t constant = i.args[2].constant.constant_value;
+
+				reducer r{rd, rs, costs};
+				if (i.i_alu == insn::alu_op::MUL) {
+					auto [it, fresh] = products.try_emplace({constant, rd == rs});
+					if (fresh) {
+						reducer p{1, rd == rs ? 1u : 2u, costs};
+						p.product(constant);
+						it->second = std::move(p.best);
+					}
+					if (it->second) {
+						sequence seq = *it->second;
+						for (auto& replacement : seq) {
+							for (auto& arg : replacement.args) {
+								if (arg.mode == parser::insn_arg::REGISTER || arg.mode == parser::insn_arg::REGISTER_LSHIFT) arg.reg = arg.reg == 1 ? rd : arg.reg == 2 ? rs : arg.reg;
+							}
+						}
+						r.consider(std::move(seq));
+					}
+				}
+				else if (uint32_t magnitude = constant & 0x8000'0000 ? -constant : constant; std::has_single_bit(magnitude)) {
+					reducer d{rd, rs, costs};
+					d.divide(std::countr_zero(magnitude));
+					// a negative divisor negates the quotient
+					if (constant & 0x8000'0000) {
+						if (magnitude == 1) d.best = {alu(insn::alu_op::SUB, rd, 0, parser::insn_arg{rs})};
+						else d.best->push_back(alu(insn::alu_op::SUB, rd, 0, parser::insn_arg{rd}));
+					}
+					r.consider(std::move(*d.best));
+				}
+				else if (rd != rs && !insn::fits(constant, 16)) r.consider(reducer::load_and(i.i_alu, rd, rs, constant));
+				// the plain instruction if its immediate fits, only where it's strictly cheaper
+				if (insn::fits(constant, 16) || (rd == rs && insn::fits(constant, 4))) r.consider({alu(i.i_alu, rd, rs, imm((int32_t)constant))});
+
+				if (!r.best) {
+					if (!insn::fits(constant, 16))
+						::report_error(pctx, i.progpos, std::string(i.i_alu == insn::alu_op::MUL ? "no short sequence multiplies" : "no short sequence divides") + " by " + std::to_string((int32_t)constant) + " in place; use a different destination register");
+					result.push_back(std::move(i));
+					continue;
+				}
+
+				// the first instruction takes over the position (for errors) and any loop bound
+				for (auto& replacement : *r.best) replacement.progpos = i.progpos;
+				if (!r.best->empty()) r.best->front().bound = i.bound;
+				for (auto& replacement : *r.best) result.push_back(std::move(replacement));
+				++changed;
+			}
+
+			section.instructions = std::move(result);
+		}
+
+		return changed;
+	}
+
+	namespace {
+		// every label an expression refers to
+		void labels_in(const parser::expr &e, std::vector<parser::labelname> &out) {
+			if (e.type == parser::expr::label) out.push_back(e.label_value);
+			for (const auto& arg : e.args) labels_in(arg, out);
+		}
+	}
+
+	size_t gc_sections(parser::pctx &pctx, const std::vector<std::string> &keep) {
+		// global labels belong to no section of their own, so find where each one is defined
+		std::map<parser::labelname, size_t> defined_in;
+		for (size_t s = 0; s < pctx.sections.size(); ++s) {
+			for (const auto& i : pctx.sections[s].instructions) {
+				if (i.type == parser::insn::LABEL) defined_in.emplace(i.lbl, s);
+			}
+		}
+
+		// errors about the options rather than any line of the source, so without a file
+		auto complain = [&](std::string &&message) {
+			pctx.diagnostics.push_back({.message = std::move(message)});
+		};
+
+		std::vector<bool> reached(pctx.sections.size());
+		std::vector<size_t> pending;
+		auto reach = [&](size_t s) {
+			if (reached[s]) return;
+			reached[s] = true;
+			pending.push_back(s);
+		};
+
+		eval::evaluator eval;
+		for (size_t s = 0; s < pctx.sections.size(); ++s) {
+			auto start = pctx.sections[s].starting_address;
+			eval.evaluate(start);
+			if (start.is_constant(0) || pctx.sections[s].irq >= 0) reach(s);
+		}
+
+		for (const auto& name : keep) {
+			bool found = false;
+			for (const auto& [lbl, id] : pctx.named_labels) {
+				if (pctx.idents.name(id) != name) continue;
+				if (auto it = defined_in.find(lbl); it != defined_in.end()) {
+					reach(it->second);
+					found = true;
+				}
+			}
+			if (!found) complain("--keep: no label named " + name);
+		}
+
+		std::vector<parser::labelname> used;
+		while (!pending.empty()) {
+			auto& section = pctx.sections[pending.back()];
+			pending.pop_back();
+
+			used.clear();
+			labels_in(section.starting_address, used);
+			labels_in(section.irq_spill, used);
+			labels_in(section.float_base, used);
+			labels_in(section.float_end, used);
+			for (const auto& i : section.instructions) {
+				for (const auto& arg : i.args) labels_in(arg.constant, used);
+				if (i.type == parser::insn::LOADSTORE) labels_in(i.addr.constant, used);
+				if (i.type == parser::insn::DATA) {
+					labels_in(i.raw.low, used);
+					labels_in(i.raw.high, used);
+				}
+			}
+			for (const auto& lbl : used) {
+				if (auto it = defined_in.find(lbl); it != defined_in.end()) reach(it->second);
+			}
+		}
+
+		size_t kept = 0;
+		for (size_t s = 0; s < pctx.sections.size(); ++s) {
+			if (!reached[s]) continue;
+			if (kept != s) pctx.sections[kept] = std::move(pctx.sections[s]);
+			++kept;
+		}
+		size_t dropped = pctx.sections.size() - kept;
+		pctx.sections.resize(kept);
+
+		if (pctx.sections.empty() && pctx.diagnostics.empty()) complain("--gc-sections: nothing starts at address 0 or is kept, so every section was dropped");
+		return dropped;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <parser.h>
+#include "wcet.h"
+
+namespace masm::opt {
+	// Jump threading, on the parsed (but not yet laid out) program:
+	//
+	//  - a jmp (conditional or not) to a label that's just an unconditional jmp is pointed at that
+	//    one's target instead, as many times as it takes
+	//  - a jmp to a label on the very next instruction is removed
+	//  - instructions after an unconditional jmp to a label are removed up to the next label or
+	//    data (not after a call, which returns to them, or a jump through a register, which
+	//    might land on them)
+	//
+	// The last two are repeated until nothing more goes. Labels are never removed, so anything referring to them still resolves. Returns how many
+	// instructions were retargeted or removed.
+	size_t thread_jumps(parser::pctx &pctx);
+
+	// Strength reduction for muli/divi, once their constants are known:
+	//
+	//  - muli becomes the cheapest of up to four add/sub/lsl instructions (using the shifted
+	//    register operand styles), the constant built in rd and a mul by it (if rd isn't rs), or
+	//    a plain mul. The search for the add/sub/lsl chains is cut short on constants with many
+	//    candidates, and is only done once for each constant
+	//  - divi by a power of two (or its negative) becomes shifts with a rounding correction, so it
+	//    still rounds towards zero like div does; other divisors use a plain div, with the divisor
+	//    built in rd first if it's too wide for an immediate (and rd isn't rs)
+	//
+	// Sequences only ever write rd. They are compared by cycles and then bytes, using the encodings
+	// layout will pick and the given cycle costs. Anything that can't be reduced is left as the
+	// mul/div it started as. Returns how many instructions were replaced.
+	size_t reduce_strength(parser::pctx &pctx, const wcet::costs &costs = {});
+
+	// Section garbage collection, before layout. The roots are sections starting at address 0,
+	// .irq handlers and sections defining a label named in keep; from there, any label used in
+	// an instruction, an address or data (or a section's .org) keeps the section that defines
+	// it. Every section that isn't reached is dropped. Names in keep that aren't labels are
+	// errors, as is having nothing left. Returns how many sections were dropped.
+	size_t gc_sections(parser::pctx &pctx, const std::vector<std::string> &keep = {});
+}
@@ -11,8 +11,15 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <algorithm>
+#include <memory>
 #include <charconv>
+#include <filesystem>
+#include <stdexcept>
 #include <insns.h>
+#include <blob.h>
+#include <diagnostic.h>
 #include <utility>
 #include <unordered_map>
 #include <unordered_set>
@@ -67,6 +74,7 @@ namespace masm::parser {
 
 	struct mov_insn {
 		bool is_jmp = false;
+		bool is_call = false;
 		enum c {
 #define o(n, _, __, ___) n,
 			ENUM_MOV_CONDS(o)
@@ -103,6 +111,48 @@ namespace masm::parser {
 
 #undef ENUM_MOV_CONDS
 
+	// Interned identifier, stable for the whole assembly (a distinct type so bison keeps it apart
+	// from register numbers)
+	enum class ident : uint32_t {};
+
+	// Arena of identifier names. Names are copied in once; everything afterwards passes ids
+	// (or views into the arena) around.
+	struct idtable {
+		ident intern(std::string_view name) {
+			if (auto it = ids.find(name); it != ids.end()) return it->second;
+
+			if (name.size() > block_left) {
+				size_t size = std::max(name.size(), block_size);
+				blocks.emplace_back(std::make_unique<char[]>(size));
+				block_next = blocks.back().get();
+				block_left = size;
+			}
+			std::copy(name.begin(), name.end(), block_next);
+			std::string_view stored{block_next, name.size()};
+			block_next += name.size();
+			block_left -= name.size();
+
+			ident id{(uint32_t)names.size()};
+			names.push_back(stored);
+			ids.emplace(stored, id);
+			return id;
+		}
+
+		std::string_view name(ident id) const {
+			return names[(uint32_t)id];
+		}
+
+	private:
+		static constexpr size_t block_size = 16 * 1024;
+
+		std::vector<std::unique_ptr<char[]>> blocks;
+		char *block_next = nullptr;
+		size_t block_left = 0;
+
+		std::vector<std::string_view> names;
+		std::unordered_map<std::string_view, ident> ids;
+	};
+
 	struct labelname {
 		size_t section = 0;
 		size_t index = 0;
@@ -186,8 +236,23 @@ namespace masm::parser {
 			BYTES,
 			WORD,
 			DOUBLEWORD,
-			QUADWORD
+			QUADWORD,
+			SPAN
 		} type;
+
+		// SPAN: a run of constant bytes, which bytes keeps alive. An odd length is padded with
+		// a zero when laid out to keep things word aligned.
+		std::shared_ptr<const uint8_t> bytes;
+		size_t size = 0;
+
+		static rawdata make_span(std::vector<uint8_t> &&data) {
+			auto owner = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+			rawdata r;
+			r.type = SPAN;
+			r.size = owner->size();
+			r.bytes = std::shared_ptr<const uint8_t>(owner, owner->data());
+			return r;
+		}
 	};
 
 	struct insn {
@@ -209,6 +274,14 @@ namespace masm::parser {
 		std::vector<insn_arg> args;
 		rawdata raw;
 
+		// from .bound: how many times this (backwards) branch is taken each time its loop runs,
+		// -1 if not given
+		int64_t bound = -1;
+
+		// muli/divi: a mul/div by a constant that opt::reduce_strength may replace with cheaper
+		// instructions
+		bool reduce = false;
+
 		yy::location progpos;
 
 		insn() = default;
@@ -232,11 +305,32 @@ namespace masm::parser {
 			type(DATA), raw(std::move(rd)) {}
 	};
 
+	// interrupt vectors are irq_slot bytes apart
+	inline constexpr int64_t irq_slot = 16;
+	inline constexpr int64_t irq_count = 16;
+
 	struct section {
 		expr starting_address; // 0xffff'ffff for position independent
 		size_t index = 0;
 		std::vector<insn> instructions;
 		size_t num_labels = 0;
+		yy::location progpos;
+
+		// from .float: position independent, and placed by layout somewhere in [float_base, float_end)
+		// on a multiple of align
+		bool floating = false;
+		expr float_base, float_end;
+		int64_t align = 2;
+
+		// from .irq: the vector slot this section is the handler for (-1 if it isn't one), and
+		// where the handler goes instead if it doesn't fit in the slot
+		int64_t irq = -1;
+		expr irq_spill;
+
+		// from .compress: stored compressed and expanded by the .lzunpack routine (see lz.h);
+		// from .lzunpack: that routine and the compressed data go on the end of this section
+		bool compress = false;
+		bool lzunpack = false;
 
 		labelname new_label() {
 			labelname lbl;
@@ -264,17 +358,35 @@ struct pctx {
 	
 	std::vector<section> sections;
 
-	std::unordered_map<std::string, labelname> local_labels;
+	// searched for .incbin files after the directory of the file being assembled
+	std::vector<std::string> include_dirs;
+	// every file pulled in while parsing, for dependency tracking
+	std::vector<std::string> dependencies;
+	// errors so far, from any stage
+	std::vector<diagnostic> diagnostics;
+
+	idtable idents;
+
+	std::unordered_map<ident, labelname> local_labels;
 	std::unordered_set<size_t> defined_local_labels;
 	std::unordered_set<size_t> defined_global_labels;
-	std::unordered_map<std::string, labelname> global_labels;
+	std::unordered_map<ident, labelname> global_labels;
+	// every label defined with a name, for anything that wants to report by name
+	std::vector<std::pair<labelname, ident>> named_labels;
 
 	std::vector<insn_arg> address_components;
 	std::vector<expr> data_components;
 
 	bool jumpflag = false, hereflag = false;
+	int64_t pending_bound = -1;
 	labelname jsrlabel{}, herelabel{};
 
+	// from .irqtable
+	bool has_irq_table = false;
+	expr irq_base, irq_spill;
+
+	bool has_lzunpack = false;
+
 	void prepare_cursor(const char *newcursor) {
 		ptrdiff_t o = 0;
 		const char *lt = newcursor;
@@ -282,7 +394,7 @@ struct pctx {
 		lineoffsets.clear();
 		lineoffsets.push_back(0);
 		while (*lt) {
-			if (*(lt - 1) == '\n') {
+			if (lt != newcursor && *(lt - 1) == '\n') {
 				lineoffsets.push_back(o);
 			}
 			++o;
@@ -292,54 +404,53 @@ struct pctx {
 		cursor = start = newcursor;
 	}
 
-	labelname define_label(std::string name, bool by_use=false) {
+	labelname define_label(ident name, bool by_use=false) {
 		if (sections.empty()) throw yy::mcasm_parser::syntax_error(loc, "defined label before section started");
 		// try to define a global label
-		if (global_labels.count(name)) {
-			if (defined_global_labels.contains(global_labels[name].index)) {
-				throw yy::mcasm_parser::syntax_error(loc, "multiple definitions of global label " + name);
+		if (auto global = global_labels.find(name); global != global_labels.end()) {
+			if (!defined_global_labels.insert(global->second.index).second) {
+				throw yy::mcasm_parser::syntax_error(loc, "multiple definitions of global label " + std::string(idents.name(name)));
 			}
-			labelname tgt = global_labels[name];
-			defined_global_labels.insert(tgt.index);
-			sections.back().instructions.emplace_back(tgt); // add the label into the insns
-			return tgt;
+			sections.back().instructions.emplace_back(global->second); // add the label into the insns
+			named_labels.emplace_back(global->second, name);
+			return global->second;
 		}
 		// if there's a label with this name defined locally, but it has never been previously set, return it
-		if (local_labels.count(name) && !defined_local_labels.count(local_labels[name].index)) {
-			labelname prev_lbl = local_labels[name];
-			defined_local_labels.insert(prev_lbl.index);
-			sections.back().instructions.emplace_back(prev_lbl); // add the label into the insns
-			return prev_lbl;
+		auto [local, added] = local_labels.try_emplace(name);
+		if (!added && defined_local_labels.insert(local->second.index).second) {
+			sections.back().instructions.emplace_back(local->second); // add the label into the insns
+			named_labels.emplace_back(local->second, name);
+			return local->second;
 		}
 		labelname lbl = sections.back().new_label();
-		local_labels[name] = lbl; // this intentionally overwrites prior entries to allow for repeated labels for things like loops
+		local->second = lbl; // this intentionally overwrites prior entries to allow for repeated labels for things like loops
 		if (!by_use) {
 			defined_local_labels.insert(lbl.index); // mark this as used
 			sections.back().instructions.emplace_back(lbl); // add the label
+			named_labels.emplace_back(lbl, name);
 		}
 		return lbl;
 	}
 
-	labelname lookup(std::string name) {
+	labelname lookup(ident name) {
 		// search for local label first, local labels override global ones
-		if (local_labels.count(name)) {
-			return local_labels[name];
+		if (auto local = local_labels.find(name); local != local_labels.end()) {
+			return local->second;
 		}
 		// then search for a global label
-		if (global_labels.count(name)) {
-			return global_labels[name];
+		if (auto global = global_labels.find(name); global != global_labels.end()) {
+			return global->second;
 		}
 		// otherwise, define a new label 
 		return define_label(name, true);
 	}
 
-	void globalize(std::string name) {
-		if (global_labels.count(name)) {
-			throw yy::mcasm_parser::syntax_error(loc, "multiple conflicting definitions for global label " + name);
-		}
+	void globalize(ident name) {
 		labelname target {~0u, global_labels.size()};
 		// add target to global table
-		global_labels[name] = target;
+		if (!global_labels.try_emplace(name, target).second) {
+			throw yy::mcasm_parser::syntax_error(loc, "multiple conflicting definitions for global label " + std::string(idents.name(name)));
+		}
 	}
 
 	void end_section() {
@@ -350,7 +461,7 @@ struct pctx {
 		if (sections.back().num_labels != defined_local_labels.size()) {
 			// Find the first undefined label
 			for (const auto& [name, lbl] : local_labels) {
-				if (!defined_local_labels.count(lbl.index)) throw yy::mcasm_parser::syntax_error(loc, "local label " + name + " was never defined");
+				if (!defined_local_labels.count(lbl.index)) throw yy::mcasm_parser::syntax_error(loc, "local label " + std::string(idents.name(name)) + " was never defined");
 			}
 		}
 		// Clear local label data for next section
@@ -358,14 +469,45 @@ struct pctx {
 		defined_local_labels.clear();
 	}
 
-	void start_section(expr &&starting_address) {
+	void start_section(const yy::location& pos, expr &&starting_address) {
 		if (!sections.empty()) end_section();
 		section new_section;
 		new_section.starting_address = std::move(starting_address);
 		new_section.index = sections.size();
+		new_section.progpos = pos;
 		sections.emplace_back(std::move(new_section));
 	}
 
+	void start_floating_section(const yy::location& pos, expr &&base, expr &&end, int64_t align) {
+		if (align < 1 || (align & (align - 1))) throw yy::mcasm_parser::syntax_error(pos, "alignment must be a power of two");
+		start_section(pos, expr((int64_t)0xffffffff));
+		sections.back().floating = true;
+		sections.back().float_base = std::move(base);
+		sections.back().float_end = std::move(end);
+		// instructions are always on a halfword
+		sections.back().align = std::max<int64_t>(align, 2);
+	}
+
+	void start_irq_table(expr &&base, expr &&spill) {
+		has_irq_table = true;
+		irq_base = std::move(base);
+		irq_spill = std::move(spill);
+	}
+
+	void start_irq_table(expr &&base) {
+		// handlers that don't fit go straight after the slots
+		expr spill = expr::make_add(expr{base}, expr(irq_count * irq_slot));
+		start_irq_table(std::move(base), std::move(spill));
+	}
+
+	void start_irq(const yy::location& pos, int64_t irq) {
+		if (!has_irq_table) throw yy::mcasm_parser::syntax_error(pos, ".irq without an .irqtable");
+		if (irq < 0 || irq >= irq_count) throw yy::mcasm_parser::syntax_error(pos, "interrupt number out of range");
+		start_section(pos, expr::make_add(expr{irq_base}, expr(irq * irq_slot)));
+		sections.back().irq = irq;
+		sections.back().irq_spill = irq_spill;
+	}
+
 	void verify_instruction(const insn& i) {
 		// verify lengths of insn args
 		if (i.type == insn::MOV && i.i_mov.condition != mov_insn::AL && i.args.size() < 3) throw yy::mcasm_parser::syntax_error(insnpos, "too few arguments for condition mov/jmp");
@@ -379,13 +521,38 @@ struct pctx {
 	void add_insn(insn &&i, bool eff=true) {
 		i.progpos = insnpos;
 		if (sections.empty()) throw yy::mcasm_parser::syntax_error(loc, "instructions before section start");
+		if (sections.back().lzunpack && i.type != insn::LABEL) throw yy::mcasm_parser::syntax_error(insnpos, "nothing can follow .lzunpack in its section");
 		if (hereflag && eff) {
 			// add a herelabel
 			sections.back().instructions.emplace_back(herelabel);
 		}
+		if (eff) {
+			i.bound = pending_bound;
+			pending_bound = -1;
+		}
 		sections.back().instructions.emplace_back(std::move(i));
 	}
 
+	void compress_section() {
+		if (sections.empty()) throw yy::mcasm_parser::syntax_error(loc, ".compress before section start");
+		if (sections.back().irq >= 0) throw yy::mcasm_parser::syntax_error(loc, "interrupt handlers can't be compressed");
+		if (sections.back().lzunpack) throw yy::mcasm_parser::syntax_error(loc, "the .lzunpack section can't be compressed");
+		sections.back().compress = true;
+	}
+
+	void place_lzunpack() {
+		if (sections.empty()) throw yy::mcasm_parser::syntax_error(loc, ".lzunpack before section start");
+		if (has_lzunpack) throw yy::mcasm_parser::syntax_error(loc, "multiple .lzunpack");
+		if (sections.back().compress) throw yy::mcasm_parser::syntax_error(loc, "the .lzunpack section can't be compressed");
+		has_lzunpack = true;
+		sections.back().lzunpack = true;
+	}
+
+	void set_bound(int64_t bound) {
+		if (bound < 0) throw yy::mcasm_parser::syntax_error(loc, "loop bound must not be negative");
+		pending_bound = bound;
+	}
+
 	void end_insn() {
 		// emit label for jumpflag
 		if (jumpflag) {
@@ -488,14 +655,30 @@ struct pctx {
 		data_components.emplace_back(std::move(component));
 	}
 	void end_data(rawdata::t kind) {
-		if (kind == rawdata::BYTES) {
-			// ensure we are still aligned to words
-			if (this->data_components.size() % 2) {
-				this->data_components.clear();
-				
-				throw yy::mcasm_parser::syntax_error(loc, "byte data is not word aligned; if you want an odd number of bytes, manually pad them with zeroes to the nearest word.");
+		// ensure we are still aligned to words
+		if (kind == rawdata::BYTES && this->data_components.size() % 2) {
+			this->data_components.clear();
+
+			throw yy::mcasm_parser::syntax_error(loc, "byte data is not word aligned; if you want an odd number of bytes, manually pad them with zeroes to the nearest word.");
+		}
+
+		// All constants (tables, fonts, etc.) go in as one span rather than an insn per word
+		if (std::all_of(data_components.begin(), data_components.end(), [](const expr& e){return e.type == expr::num;})) {
+			size_t width = kind == rawdata::BYTES ? 1 : kind == rawdata::WORD ? 2 : kind == rawdata::DOUBLEWORD ? 4 : 8;
+			std::vector<uint8_t> bytes;
+			bytes.reserve(data_components.size() * width);
+			for (const auto& e : data_components) {
+				for (size_t i = 0; i < width; ++i) bytes.push_back(e.constant_value >> (i * 8));
 			}
-			
+			this->data_components.clear();
+
+			start_insn();
+			add_insn(insn{rawdata::make_span(std::move(bytes))});
+			end_insn();
+			return;
+		}
+
+		if (kind == rawdata::BYTES) {
 			bool hi = false;
 			rawdata entry;
 			entry.type = kind;
@@ -520,7 +703,9 @@ struct pctx {
 				add_insn(insn{rawdata{
 					.low = std::move(e),
 					.high = expr{},
-					.type = kind
+					.type = kind,
+					.bytes = nullptr,
+					.size = 0
 				}});
 				end_insn();
 			}
@@ -528,6 +713,85 @@ struct pctx {
 
 		this->data_components.clear();
 	}
+
+	void define_string(const std::string &text, bool terminate) {
+		std::vector<uint8_t> bytes(text.begin(), text.end());
+		if (terminate) bytes.push_back(0);
+		if (bytes.empty()) return;
+
+		start_insn();
+		add_insn(insn{rawdata::make_span(std::move(bytes))});
+		end_insn();
+	}
+
+	void include_binary(const yy::location &where, const std::string &path, int64_t offset = 0, int64_t length = -1) {
+		// Find the file
+		std::filesystem::path found = path;
+		if (found.is_relative()) {
+			std::vector<std::filesystem::path> dirs;
+			if (loc.begin.filename) dirs.push_back(std::filesystem::path(*loc.begin.filename).parent_path());
+			dirs.insert(dirs.end(), include_dirs.begin(), include_dirs.end());
+			auto it = std::find_if(dirs.begin(), dirs.end(), [&](const auto& dir){return std::filesystem::exists(dir / path);});
+			if (it != dirs.end()) found = *it / path;
+		}
+
+		size_t size;
+		std::shared_ptr<const uint8_t> data;
+		try {
+			data = blob::map(found.string(), size);
+		}
+		catch (std::runtime_error &e) {
+			throw yy::mcasm_parser::syntax_error(where, e.what());
+		}
+		if (std::find(dependencies.begin(), dependencies.end(), found.string()) == dependencies.end()) dependencies.push_back(found.string());
+
+		if (offset < 0 || (size_t)offset > size) throw yy::mcasm_parser::syntax_error(where, "offset is past the end of " + path);
+		if (length < 0) length = size - offset;
+		if ((size_t)length > size - offset) throw yy::mcasm_parser::syntax_error(where, "length runs past the end of " + path);
+		if (!length) return;
+
+		// point into the mapping rather than copying out of it
+		rawdata r;
+		r.type = rawdata::SPAN;
+		r.bytes = std::shared_ptr<const uint8_t>(data, data.get() + offset);
+		r.size = length;
+
+		start_insn();
+		add_insn(insn{std::move(r)});
+		end_insn();
+	}
+
+	// Contents of a string literal (without the quotes), with escapes replaced
+	std::string unescape(const char *begin, const char *end) {
+		std::string result;
+		result.reserve(end - begin);
+		for (const char *c = begin; c != end; ++c) {
+			if (*c != '\\') {
+				result.push_back(*c);
+				continue;
+			}
+			switch (*++c) {
+				case 'n': result.push_back('\n'); break;
+				case 'r': result.push_back('\r'); break;
+				case 't': result.push_back('\t'); break;
+				case '0': result.push_back('\0'); break;
+				case '\\':
+				case '"': result.push_back(*c); break;
+				case 'x':
+					{
+						unsigned v;
+						auto [ptr, ec] = std::from_chars(c + 1, std::min(c + 3, end), v, 16);
+						if (ec != std::errc{} || ptr != c + 3) throw yy::mcasm_parser::syntax_error(loc, "expected two hex digits after \\x");
+						result.push_back((char)v);
+						c = ptr - 1;
+					}
+					break;
+				default:
+					throw yy::mcasm_parser::syntax_error(loc, std::string("unknown escape \\") + *c);
+			}
+		}
+		return result;
+	}
 };
 
 }
@@ -535,15 +799,16 @@ struct pctx {
 
 %token END 0
 %token LSHIFT "<<" RSHIFT ">>"
-%token ID_ORG ".org" ID_BYTE ".db" ID_WORD ".dw" ID_DOUBLEWORD ".ddw" ID_QUADWORD ".dqw" ID_STRING ".str" ID_STRINGZ ".strz" ID_GLOBAL ".global"
-%token LOADSTORE_INSN "load/store instruction" ALU_INSN "alu instruction" MOV_INSN "mov instruction" JMP_INSN "jmp instruction" CALL_INSN "call instruction" 
-%token IDENTIFIER "name" REGISTER "register" NUMBER "number" RELATIVE_QUAL "rel"
+%token ID_ORG ".org" ID_FLOAT ".float" ID_BYTE ".db" ID_WORD ".dw" ID_DOUBLEWORD ".ddw" ID_QUADWORD ".dqw" ID_STRING ".str" ID_STRINGZ ".strz" ID_GLOBAL ".global" ID_BOUND ".bound" ID_IRQTABLE ".irqtable" ID_IRQ ".irq" ID_INCBIN ".incbin" ID_COMPRESS ".compress" ID_LZUNPACK ".lzunpack"
+%token LOADSTORE_INSN "load/store instruction" ALU_INSN "alu instruction" ALUI_INSN "constant multiply/divide" MOV_INSN "mov instruction" JMP_INSN "jmp instruction" CALL_INSN "call instruction" 
+%token IDENTIFIER "name" REGISTER "register" NUMBER "number" STRING "string" RELATIVE_QUAL "rel"
 
 %type<int64_t> NUMBER
+%type<std::string> STRING
 %type<uint32_t> REGISTER
-%type<std::string> IDENTIFIER label
+%type<masm::parser::ident> IDENTIFIER label
 %type<masm::parser::loadstore_insn> LOADSTORE_INSN
-%type<masm::insn::alu_op::e> ALU_INSN
+%type<masm::insn::alu_op::e> ALU_INSN ALUI_INSN
 %type<masm::parser::mov_insn> MOV_INSN JMP_INSN CALL_INSN
 %type<masm::parser::insn> instruction
 %type<masm::parser::insn_arg> aluop2 movop addresscomponent movtarget
@@ -583,12 +848,13 @@ label: IDENTIFIER ':' { $$ = $1; }
 
 instruction: LOADSTORE_INSN REGISTER ',' address                 { $$ = MN::insn($1, $4, $2); VI($$); }
 		   | ALU_INSN REGISTER ',' REGISTER ',' aluop2           { $$ = MN::insn($1, $2, $4, $6); VI($$); }
+		   | ALUI_INSN REGISTER ',' REGISTER ',' expr            { $$ = MN::insn($1, $2, $4, MN::insn_arg(M($6))); $$.reduce = true; VI($$); }
 		   | MOV_INSN REGISTER ',' movtarget                     { $$ = MN::insn($1, $2, $4); VI($$); }
 		   | MOV_INSN REGISTER ',' movtarget ',' movop ',' movop { $$ = MN::insn($1, $2, $4, $6, $8); VI($$); }
 		   | JMP_INSN movtarget                                  { $$ = MN::insn($1, $2); VI($$); }
 		   | JMP_INSN movtarget ',' movop ',' movop              { $$ = MN::insn($1, $2, $4, $6); VI($$); }
-		   | CALL_INSN movtarget                                 { ctx.push_jump(); $$ = MN::insn($1, $2); VI($$); }
-		   | CALL_INSN movtarget ',' movop ',' movop             { ctx.push_jump(); $$ = MN::insn($1, $2, $4, $6); VI($$); }
+		   | CALL_INSN movtarget                                 { ctx.push_jump(); $1.is_call = true; $$ = MN::insn($1, $2); VI($$); }
+		   | CALL_INSN movtarget ',' movop ',' movop             { ctx.push_jump(); $1.is_call = true; $$ = MN::insn($1, $2, $4, $6); VI($$); }
 		   ;
 	
 aluop2: expr                    { $$ = MN::insn_arg(M($1)); }
@@ -623,12 +889,25 @@ addresscomponent: expr                  { $$ = MN::insn_arg(M($1)); }
 				| REGISTER "<<" NUMBER  { $$ = MN::insn_arg($1, MN::insn_arg::REGISTER_LSHIFT, $3); }
 				;
 
-directive: ".org" expr { ctx.start_section(M($2)); }
+directive: ".org" expr { ctx.start_section(@$, M($2)); }
+		 | ".float" expr ',' expr { ctx.start_floating_section(@$, M($2), M($4), 2); }
+		 | ".float" expr ',' expr ',' NUMBER { ctx.start_floating_section(@$, M($2), M($4), $6); }
 		 | ".db" { ctx.begin_data(); } datacomponents { ctx.end_data(MN::rawdata::BYTES); }
 		 | ".dw" { ctx.begin_data(); } datacomponents { ctx.end_data(MN::rawdata::WORD); }
 		 | ".ddw" { ctx.begin_data(); } datacomponents { ctx.end_data(MN::rawdata::DOUBLEWORD); }
 		 | ".dqw" { ctx.begin_data(); } datacomponents { ctx.end_data(MN::rawdata::QUADWORD); }
+		 | ".str" STRING { ctx.define_string($2, false); }
+		 | ".strz" STRING { ctx.define_string($2, true); }
+		 | ".incbin" STRING { ctx.include_binary(@$, $2); }
+		 | ".incbin" STRING ',' NUMBER { ctx.include_binary(@$, $2, $4); }
+		 | ".incbin" STRING ',' NUMBER ',' NUMBER { ctx.include_binary(@$, $2, $4, $6); }
 		 | ".global" IDENTIFIER { ctx.globalize($2); }
+		 | ".bound" NUMBER { ctx.set_bound($2); }
+		 | ".irqtable" expr { ctx.start_irq_table(M($2)); }
+		 | ".irqtable" expr ',' expr { ctx.start_irq_table(M($2), M($4)); }
+		 | ".irq" NUMBER { ctx.start_irq(@$, $2); }
+		 | ".compress" { ctx.compress_section(); }
+		 | ".lzunpack" { ctx.place_lzunpack(); }
 		 ;
 
 datacomponents: expr                     { ctx.define_data(M($1)); }
@@ -684,11 +963,20 @@ re2c:define:YYMARKER	= "re2c_marker";
 // Directives
 
 ".org"              { return tk(ID_ORG); }
+".float"            { return tk(ID_FLOAT); }
 ".global"           { return tk(ID_GLOBAL); }
+".bound"            { return tk(ID_BOUND); }
+".irqtable"         { return tk(ID_IRQTABLE); }
+".compress"         { return tk(ID_COMPRESS); }
+".lzunpack"         { return tk(ID_LZUNPACK); }
+".irq"              { return tk(ID_IRQ); }
 ".db"               { return tk(ID_BYTE); }
 ".dw"               { return tk(ID_WORD); }
 ".ddw"              { return tk(ID_DOUBLEWORD); }
 ".dqw"              { return tk(ID_QUADWORD); } 
+".str"              { return tk(ID_STRING); }
+".strz"             { return tk(ID_STRINGZ); }
+".incbin"           { return tk(ID_INCBIN); }
 
 // Instructions
 
@@ -707,12 +995,18 @@ re2c:define:YYMARKER	= "re2c_marker";
 "sr"                { return tk(ALU_INSN, masm::insn::alu_op::SR); }
 "lsl"               { return tk(ALU_INSN, masm::insn::alu_op::LSL); }
 "lsr"               { return tk(ALU_INSN, masm::insn::alu_op::LSR); }
+"mul"               { return tk(ALU_INSN, masm::insn::alu_op::MUL); }
+"mulh"              { return tk(ALU_INSN, masm::insn::alu_op::MULH); }
 "or"                { return tk(ALU_INSN, masm::insn::alu_op::OR); }
 "eor"               { return tk(ALU_INSN, masm::insn::alu_op::EOR); }
 "and"               { return tk(ALU_INSN, masm::insn::alu_op::AND); }
 "nor"               { return tk(ALU_INSN, masm::insn::alu_op::NOR); }
 "enor"              { return tk(ALU_INSN, masm::insn::alu_op::ENOR); }
 "nand"              { return tk(ALU_INSN, masm::insn::alu_op::NAND); }
+"div"               { return tk(ALU_INSN, masm::insn::alu_op::DIV); }
+"mod"               { return tk(ALU_INSN, masm::insn::alu_op::MOD); }
+"muli"              { return tk(ALUI_INSN, masm::insn::alu_op::MUL); }
+"divi"              { return tk(ALUI_INSN, masm::insn::alu_op::DIV); }
 
 /// MOVS
 
@@ -733,7 +1027,7 @@ re2c:define:YYMARKER	= "re2c_marker";
 // Identifiers
 
 "rel"                   { return tk(RELATIVE_QUAL); }
-[a-zA-Z_] [a-zA-Z_0-9]* { return tk(IDENTIFIER, std::string(anchor, ctx.cursor)); }
+[a-zA-Z_] [a-zA-Z_0-9]* { return tk(IDENTIFIER, ctx.idents.intern(std::string_view(anchor, ctx.cursor))); }
 
 // Numbers
 
@@ -741,6 +1035,10 @@ re2c:define:YYMARKER	= "re2c_marker";
 "0x" [0-9a-fA-F]+ { int64_t v; std::from_chars(anchor + 2, ctx.cursor, v, 16); return tk(NUMBER, v); }
 "0b" [10]+        { int64_t v; std::from_chars(anchor + 2, ctx.cursor, v, 2); return tk(NUMBER, v); }
 
+// Strings
+
+"\"" ([^"\\\r\n\000] | "\\" [^\r\n\000])* "\"" { return tk(STRING, ctx.unescape(anchor + 1, ctx.cursor - 1)); }
+
 // Whitespace and ignored things
 "\000"          { return tk(END); }
 "\r\n" | [\r\n] { ctx.loc.lines();	return yylex(ctx); }
@@ -761,7 +1059,7 @@ re2c:define:YYMARKER	= "re2c_marker";
 	#undef tk
 }
 
-extern void report_error(const masm::parser::pctx& ctx, const yy::location &l, const std::string &m);
+extern void report_error(masm::parser::pctx& ctx, const yy::location &l, const std::string &m);
 
 void yy::mcasm_parser::error(const location_type &l, const std::string &m) {
 	report_error(ctx, l, m);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace masm::pool {
+	// Call body(i) for every i in [0, count), on up to threads threads (0 for one per core) with
+	// the calling thread as one of them. The range is cut into chunks of chunk items and dealt out
+	// evenly; a thread that finishes its own share steals chunks from the back of the others'.
+	// Calls for different items run concurrently, so body must only touch what belongs to its
+	// item. The first exception thrown by body is rethrown once every thread has stopped.
+	template<typename Body>
+	void for_each(size_t count, size_t chunk, unsigned threads, Body&& body) {
+		size_t chunks = (count + chunk - 1) / chunk;
+		if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+		if (threads > chunks) threads = (unsigned)chunks;
+		if (threads <= 1) {
+			for (size_t i = 0; i < count; ++i) body(i);
+			return;
+		}
+
+		// the chunks a thread has left as [front, back), packed so either end moves with one
+		// compare-exchange: the owner takes from the front, thieves from the back
+		struct alignas(64) share {
+			std::atomic<uint64_t> range;
+		};
+		std::vector<share> shares(threads);
+		for (size_t t = 0; t < threads; ++t) {
+			uint64_t front = chunks * t / threads, back = chunks * (t + 1) / threads;
+			shares[t].range.store(front << 32 | back, std::memory_order_relaxed);
+		}
+
+		auto take = [](share& s, bool front, uint32_t& c) {
+			uint64_t r = s.range.load(std::memory_order_relaxed);
+			for (;;) {
+				uint32_t f = r >> 32, b = (uint32_t)r;
+				if (f >= b) return false;
+				uint64_t next = front ? (uint64_t)(f + 1) << 32 | b : (uint64_t)f << 32 | (b - 1);
+				if (s.range.compare_exchange_weak(r, next, std::memory_order_relaxed)) {
+					c = front ? f : b - 1;
+					return true;
+				}
+			}
+		};
+
+		std::atomic<bool> failed{false};
+		std::exception_ptr error;
+
+		auto work = [&](unsigned t) {
+			try {
+				uint32_t c;
+				for (unsigned v = 0; v < threads && !failed.load(std::memory_order_relaxed); ++v) {
+					auto& s = shares[(t + v) % threads];
+					while (!failed.load(std::memory_order_relaxed) && take(s, v == 0, c)) {
+						for (size_t i = c * chunk; i < std::min(count, (c + 1) * chunk); ++i) body(i);
+					}
+				}
+			}
+			catch (...) {
+				if (!failed.exchange(true)) error = std::current_exception();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		for (unsigned t = 1; t < threads; ++t) workers.emplace_back(work, t);
+		work(0);
+		for (auto& w : workers) w.join();
+
+		if (error) std::rethrow_exception(error);
+	}
+}
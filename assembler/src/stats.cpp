@@ -0,0 +1,129 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace masm::stats {
+	namespace {
+		using ci = layt::concreteinsn;
+
+		constexpr int encodings = 7;
+		constexpr const char *encoding_names[encodings] = {"short", "tiny", "long", "big", "med", "msm", "sm"};
+		constexpr const char *miss_names[] = {"", "rd != rs", "symbolic immediate", "immediate too wide"};
+
+		struct counts {
+			size_t code = 0, data = 0;
+			size_t by_encoding[encodings] = {};
+
+			void add(const ci& c) {
+				if (c.type == ci::DATA) data += c.length();
+				else if (c.type == ci::INSN && c.i_subtype != ci::I_UNDEF) {
+					code += c.length();
+					++by_encoding[c.i_subtype];
+				}
+			}
+
+			void add(const counts& o) {
+				code += o.code;
+				data += o.data;
+				for (int i = 0; i < encodings; ++i) by_encoding[i] += o.by_encoding[i];
+			}
+		};
+
+		void row(std::ostream& os, const std::string& name, const counts& c) {
+			char buf[256];
+			snprintf(buf, sizeof buf, "%-36s %7zu %7zu", name.c_str(), c.code, c.data);
+			os << buf;
+			for (int i = 0; i < encodings; ++i) {
+				snprintf(buf, sizeof buf, " %6zu", c.by_encoding[i]);
+				os << buf;
+			}
+			os << '\n';
+		}
+
+		// The text of a line (numbered from 1) without its indentation, given where each line starts
+		std::string_view line_of(std::string_view source, const std::vector<size_t>& starts, int line) {
+			if (line < 1 || (size_t)line > starts.size()) return {};
+			size_t begin = starts[line - 1];
+			size_t end = std::min(source.find('\n', begin), source.size());
+			auto text = source.substr(begin, end - begin);
+			size_t start = text.find_first_not_of(" \t");
+			return start == std::string_view::npos ? std::string_view{} : text.substr(start);
+		}
+	}
+
+	void report(const parser::pctx& pctx, const layt::lctx& lctx, std::string_view source, std::ostream& os) {
+		// named labels by address, which split sections into routines
+		std::map<uint32_t, std::string> names;
+		for (const auto& [lbl, name] : pctx.named_labels) {
+			auto it = lctx.evalt.labelvalues.find(lbl);
+			if (it == lctx.evalt.labelvalues.end() || it->second.type != parser::expr::num) continue;
+			std::string& n = names[(uint32_t)it->second.constant_value];
+			if (!n.empty()) n += ", ";
+			n += pctx.idents.name(name);
+		}
+
+		char buf[64];
+		snprintf(buf, sizeof buf, "%-36s %7s %7s", "encoding density:", "code", "data");
+		os << buf;
+		for (const char *e : encoding_names) {
+			snprintf(buf, sizeof buf, " %6s", e);
+			os << buf;
+		}
+		os << '\n';
+
+		counts total;
+		std::vector<std::pair<uint32_t, const ci *>> missed;
+		// layout leaves the sections in address order
+		for (const auto& ls : lctx.sections) {
+			counts section;
+			std::vector<std::pair<std::string, counts>> routines;
+
+			uint32_t addr = ls.base_address;
+			std::optional<uint32_t> routine_at;
+			for (const auto& c : ls.contents) {
+				if (auto it = names.find(addr); it != names.end() && routine_at != addr) {
+					routines.emplace_back(it->second, counts{});
+					routine_at = addr;
+				}
+				section.add(c);
+				if (!routines.empty()) routines.back().second.add(c);
+				if (c.type == ci::INSN && c.missed != ci::MISS_NONE) missed.emplace_back(addr, &c);
+				addr += c.length();
+			}
+			total.add(section);
+
+			yy::location pos = ls.contents.empty() ? yy::location{} : ls.contents.front().progpos;
+			snprintf(buf, sizeof buf, "section 0x%08x", ls.base_address);
+			std::string title = buf;
+			if (pos.begin.filename) title += " (" + *pos.begin.filename + ":" + std::to_string(pos.begin.line) + ")";
+			row(os, title, section);
+			// a section that's all one routine from its start doesn't need it repeated
+			if (routines.size() == 1 && names.count(ls.base_address)) continue;
+			for (const auto& [name, c] : routines) row(os, "  " + name, c);
+		}
+		row(os, "total", total);
+
+		std::vector<size_t> starts{0};
+		for (size_t i = 0; i < source.size(); ++i) {
+			if (source[i] == '\n') starts.push_back(i + 1);
+		}
+
+		size_t by_reason[std::size(miss_names)] = {};
+		for (const auto& [addr, c] : missed) ++by_reason[c->missed];
+		os << "\nmissed short forms: " << missed.size();
+		for (size_t i = 1; i < std::size(miss_names); ++i) os << (i == 1 ? " (" : ", ") << by_reason[i] << ' ' << miss_names[i];
+		os << ")\n";
+		for (const auto& [addr, c] : missed) {
+			snprintf(buf, sizeof buf, "  0x%08x  %-20s  ", addr, miss_names[c->missed]);
+			os << buf;
+			if (c->progpos.begin.filename) os << *c->progpos.begin.filename << ':' << c->progpos.begin.line << ": ";
+			os << line_of(source, starts, c->progpos.begin.line) << '\n';
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <ostream>
+#include <string_view>
+#include "layt.h"
+
+namespace masm::stats {
+	// Write how densely the laid out program is encoded to os: for each section, and each stretch
+	// of it from one named label to the next, the bytes of code and data and how many instructions
+	// got each encoding. Then every instruction that has a short form but didn't get it, and why:
+	//
+	//  - rd != rs: the short alu forms write the register they read
+	//  - symbolic immediate: a label that wasn't known yet when it was laid out (usually a forward
+	//    reference), so the long form had to be kept in case it doesn't fit
+	//  - immediate too wide: doesn't fit in the short form's 4 bits (or, for loads and stores,
+	//    isn't the zero offset the short form implies)
+	//
+	// source is the text that was assembled, to quote the lines.
+	void report(const parser::pctx& pctx, const layt::lctx& lctx, std::string_view source, std::ostream& os);
+}
@@ -0,0 +1,489 @@
+#include "wcet.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdio.h>
+#include <unordered_map>
+
+namespace masm::wcet {
+	namespace {
+		// see lib/cpuregs.inc
+		constexpr uint32_t task_active = 0x8000'0010;
+
+		struct edge {
+			size_t to;
+			uint64_t cost;
+			int64_t bound;
+		};
+
+		struct node {
+			uint32_t address = 0;
+			int line = 0;
+			bool data = false;
+
+			uint64_t cost = 0;
+			std::vector<edge> succ;
+			// set if a path can end here, to what that costs on top of cost
+			std::optional<uint64_t> exit;
+			// the callee, for the jmp of a call sequence
+			std::optional<size_t> call;
+			// why paths through here can't be bounded
+			std::string problem;
+
+			bool live = true;
+		};
+
+		struct result {
+			std::optional<uint64_t> cycles;
+			std::string problem;
+		};
+
+		std::string where(const node& n) {
+			char buf[64];
+			snprintf(buf, sizeof buf, "0x%08x (line %d)", n.address, n.line);
+			return buf;
+		}
+
+		// The fields the cpu would decode from a laid out instruction
+		insn::decoded fields(const layt::concreteinsn& ci, const eval::evaluator& evalt) {
+			bool is_long = ci.i_subtype != layt::concreteinsn::I_SHORT && ci.i_subtype != layt::concreteinsn::I_TINY;
+
+			insn::decoded d{};
+			d.opcode = ci.opcode;
+			d.fmt = insn::format_for(ci.opcode, is_long);
+			d.rd = ci.rd;
+			d.rs = ci.rd;
+			switch (d.fmt) {
+				case insn::format::S:
+					d.ro = ci.ro;
+					break;
+				case insn::format::L:
+				case insn::format::T:
+					d.rs = ci.rs;
+					d.ro = ci.ro;
+					break;
+				case insn::format::M:
+				case insn::format::F:
+					d.ro = ci.ro;
+					break;
+				default:
+					break;
+			}
+			if (d.fmt == insn::format::F || d.fmt == insn::format::T) d.FF = ci.FF;
+			if (d.fmt != insn::format::S) d.imm = (int32_t)evalt.completely_evaluate<uint32_t>(ci.imm_code);
+			return d;
+		}
+
+		struct analysis {
+			std::vector<node> nodes;
+			std::unordered_map<uint32_t, size_t> by_address;
+
+			// call targets already worked out, and the ones being worked out
+			std::map<size_t, result> functions;
+			std::set<size_t> in_progress;
+
+			std::optional<size_t> lookup(uint32_t address) const {
+				auto it = by_address.find(address);
+				if (it == by_address.end() || nodes[it->second].data) return std::nullopt;
+				return it->second;
+			}
+
+			void build(const layt::lctx& lctx, const costs& c) {
+				for (const auto& section : lctx.sections) {
+					uint32_t address = section.base_address;
+					for (const auto& ci : section.contents) {
+						by_address.try_emplace(address, nodes.size());
+						node& n = nodes.emplace_back();
+						n.address = address;
+						n.line = ci.progpos.begin.line;
+						n.data = ci.type != layt::concreteinsn::INSN;
+						address += ci.length();
+					}
+				}
+
+				size_t i = 0;
+				for (const auto& section : lctx.sections) {
+					for (const auto& ci : section.contents) connect(nodes[i++], ci, lctx.evalt, c);
+				}
+			}
+
+			void connect(node& n, const layt::concreteinsn& ci, const eval::evaluator& evalt, const costs& c) {
+				if (n.data) {
+					n.problem = "runs into data at " + where(n);
+					return;
+				}
+
+				insn::decoded d;
+				try {
+					d = fields(ci, evalt);
+				}
+				catch (std::domain_error &e) {
+					n.problem = std::string(e.what()) + " at " + where(n);
+					return;
+				}
+				n.cost = c.encoding[d.fmt];
+
+				auto fall = [&]{
+					if (auto t = lookup(n.address + d.length())) n.succ.push_back({*t, 0, -1});
+					else n.problem = "runs off the end of its section at " + where(n);
+				};
+				auto jump = [&](uint32_t target){
+					if (auto t = lookup(target)) n.succ.push_back({*t, c.taken, ci.bound});
+					else n.problem = "jumps outside the program at " + where(n);
+				};
+
+				switch (d.opcode >> 5) {
+					case 0b00:
+						{
+							bool store = (d.opcode >> 4) & 1;
+
+							std::optional<uint32_t> address;
+							switch (d.fmt) {
+								case insn::format::F:
+									if (!d.ro) address = (d.FF << 30) | ((uint32_t)d.imm & 0x3fff'ffff);
+									break;
+								case insn::format::T:
+									if (!d.rs && (d.ro == 0 || d.ro == 15)) address = (d.ro == 15 ? n.address : 0) + d.imm;
+									break;
+								default:
+									if (!d.ro) address = 0;
+									break;
+							}
+							n.cost += address ? c.quadrant[*address >> 30] : *std::max_element(c.quadrant.begin(), c.quadrant.end());
+
+							if (!store && d.rd == 15) n.problem = "loads pc at " + where(n);
+							else if (store && address && (*address & ~1u) == task_active) n.exit = c.taken;
+							else fall();
+						}
+						break;
+
+					case 0b01:
+						{
+							uint32_t op = d.opcode & 0b11;
+							uint32_t cond = (d.opcode >> 2) & 0b111;
+
+							if (op != insn::mov_op::JUMP && d.rd != 15) {
+								fall();
+								break;
+							}
+
+							uint32_t src = op == insn::mov_op::JUMP ? d.rd : op == insn::mov_op::MRS ? d.rs : d.ro;
+							int32_t offset = d.FF == 0b11 ? d.imm : 0;
+
+							std::optional<uint32_t> target;
+							bool is_return = false;
+							if (op == insn::mov_op::MIMM) target = d.imm;
+							else if (src == 15) target = n.address + offset;
+							else if (src == 14 && !offset) is_return = true;
+
+							if (ci.is_call) {
+								auto callee = target ? lookup(*target) : std::nullopt;
+								if (!callee) {
+									n.problem = (target ? "calls outside the program at " : "calls through a register at ") + where(n);
+									break;
+								}
+								// the call returns to the instruction after the jmp
+								n.call = *callee;
+								n.cost += c.taken;
+								fall();
+								break;
+							}
+
+							if (is_return) n.exit = c.taken;
+							else if (target) jump(*target);
+							else {
+								n.problem = "jumps through a register at " + where(n);
+								break;
+							}
+							if (cond != insn::mov_cond::AL) fall();
+						}
+						break;
+
+					default:
+						if (uint32_t op = (d.opcode >> 2) & 0b1111; op == insn::alu_op::DIV || op == insn::alu_op::MOD) n.cost += c.divide;
+						if (d.rd != 15) fall();
+						else if ((d.opcode & 0b11) == insn::alu_sty::IMM && ((d.opcode >> 2) & 0b1111) == insn::alu_op::ADD &&
+							(d.fmt == insn::format::A ? d.rs : d.ro) == 15)
+							jump(n.address + d.imm);
+						else n.problem = "computes a jump at " + where(n);
+						break;
+				}
+			}
+
+			const result& function(size_t entry) {
+				if (auto it = functions.find(entry); it != functions.end()) return it->second;
+				in_progress.insert(entry);
+				result r = run(entry);
+				in_progress.erase(entry);
+				return functions[entry] = std::move(r);
+			}
+
+			// Worst case from entry until a return, task switch or the end of the program
+			result run(size_t entry) {
+				// Copy out the reachable part, so loops can be collapsed in place
+				std::vector<node> g;
+				std::unordered_map<size_t, size_t> local;
+				std::vector<size_t> work{entry};
+				local[entry] = 0;
+				g.push_back(nodes[entry]);
+				while (!work.empty()) {
+					size_t n = work.back();
+					work.pop_back();
+					for (const auto& e : nodes[n].succ) {
+						if (local.try_emplace(e.to, g.size()).second) {
+							g.push_back(nodes[e.to]);
+							work.push_back(e.to);
+						}
+					}
+				}
+				for (auto& n : g) {
+					for (auto& e : n.succ) e.to = local.at(e.to);
+				}
+
+				for (auto& n : g) {
+					if (!n.problem.empty()) return {std::nullopt, n.problem};
+					if (!n.call) continue;
+					if (in_progress.contains(*n.call)) return {std::nullopt, "recursive call at " + where(n)};
+					const result& callee = function(*n.call);
+					if (!callee.cycles) return {std::nullopt, callee.problem + ", called at " + where(n)};
+					n.cost += *callee.cycles;
+				}
+
+				// Collapse loops, innermost first, until what's left is acyclic
+				while (true) {
+					auto back = back_edges(g);
+					if (back.empty()) break;
+
+					std::map<size_t, std::vector<std::pair<size_t, size_t>>> by_header;
+					for (auto [from, e] : back) by_header[g[from].succ[e].to].emplace_back(from, e);
+
+					size_t header = 0;
+					std::vector<bool> body;
+					size_t body_size = ~(size_t)0;
+					for (const auto& [h, latches] : by_header) {
+						auto b = loop_body(g, h, latches);
+						size_t size = std::count(b.begin(), b.end(), true);
+						if (size < body_size) {
+							header = h;
+							body = std::move(b);
+							body_size = size;
+						}
+					}
+
+					if (auto problem = collapse(g, header, by_header[header], body)) return {std::nullopt, *problem};
+				}
+
+				return {longest_path(g), {}};
+			}
+
+			// (node, edge index) for each edge that closes a cycle in a depth first walk
+			static std::vector<std::pair<size_t, size_t>> back_edges(const std::vector<node>& g) {
+				std::vector<std::pair<size_t, size_t>> back;
+				std::vector<uint8_t> state(g.size(), 0); // 0 = unseen, 1 = on the stack, 2 = done
+				std::vector<std::pair<size_t, size_t>> stack{{0, 0}};
+				state[0] = 1;
+				while (!stack.empty()) {
+					auto& [n, e] = stack.back();
+					if (e == g[n].succ.size()) {
+						state[n] = 2;
+						stack.pop_back();
+						continue;
+					}
+					size_t to = g[n].succ[e].to;
+					if (state[to] == 1) back.emplace_back(n, e);
+					++e;
+					if (state[to] == 0) {
+						state[to] = 1;
+						stack.emplace_back(to, 0);
+					}
+				}
+				return back;
+			}
+
+			// The header, plus everything that reaches one of the latches without going through it
+			static std::vector<bool> loop_body(const std::vector<node>& g, size_t header, const std::vector<std::pair<size_t, size_t>>& latches) {
+				std::vector<std::vector<size_t>> preds(g.size());
+				for (size_t n = 0; n < g.size(); ++n) {
+					if (!g[n].live) continue;
+					for (const auto& e : g[n].succ) preds[e.to].push_back(n);
+				}
+
+				std::vector<bool> body(g.size(), false);
+				body[header] = true;
+				std::vector<size_t> work;
+				for (auto [from, _] : latches) work.push_back(from);
+				while (!work.empty()) {
+					size_t n = work.back();
+					work.pop_back();
+					if (body[n]) continue;
+					body[n] = true;
+					for (size_t p : preds[n]) work.push_back(p);
+				}
+				return body;
+			}
+
+			// Replace a loop with its header, which then costs all the bounded iterations and leaves
+			// along the loop's exits with whatever the last pass through it costs to get there.
+			static std::optional<std::string> collapse(std::vector<node>& g, size_t header, const std::vector<std::pair<size_t, size_t>>& latches, const std::vector<bool>& body) {
+				uint64_t iterations = 0;
+				for (auto [from, e] : latches) {
+					int64_t bound = g[from].succ[e].bound;
+					if (bound < 0) {
+						// Going forwards into the header only closes a loop when the analysis started
+						// part way round one, whose real top is where the outermost jump back in it goes
+						std::optional<std::pair<size_t, const edge *>> top;
+						if (g[header].address > g[from].address) {
+							for (size_t n = 0; n < g.size(); ++n) {
+								if (!body[n]) continue;
+								for (const auto& b : g[n].succ) {
+									if (!body[b.to] || b.to == header || g[b.to].address > g[n].address) continue;
+									if (!top || g[b.to].address < g[top->second->to].address) top = {n, &b};
+								}
+							}
+						}
+						if (top) {
+							auto [latch, b] = *top;
+							if (b->bound < 0) return "loop at " + where(g[b->to]) + " has no .bound on its branch at " + where(g[latch]);
+							return "starts part way round the loop at " + where(g[b->to]) + ", so its .bound can't be used";
+						}
+						return "loop at " + where(g[header]) + " has no .bound on its branch at " + where(g[from]);
+					}
+					iterations += bound;
+				}
+
+				// Order the body without the edges back to the header
+				std::vector<size_t> indegree(g.size(), 0), order;
+				for (size_t n = 0; n < g.size(); ++n) {
+					if (!body[n]) continue;
+					for (const auto& e : g[n].succ) if (body[e.to] && e.to != header) ++indegree[e.to];
+				}
+				order.push_back(header);
+				for (size_t i = 0; i < order.size(); ++i) {
+					for (const auto& e : g[order[i]].succ) {
+						if (body[e.to] && e.to != header && --indegree[e.to] == 0) order.push_back(e.to);
+					}
+				}
+				if (order.size() != (size_t)std::count(body.begin(), body.end(), true)) return "loop at " + where(g[header]) + " has more than one way in";
+
+				// Longest way from the start of the header to the start of each node in one pass
+				std::vector<std::optional<uint64_t>> dist(g.size());
+				dist[header] = 0;
+				for (size_t n : order) {
+					if (!dist[n]) continue;
+					for (const auto& e : g[n].succ) {
+						if (!body[e.to] || e.to == header) continue;
+						uint64_t d = *dist[n] + g[n].cost + e.cost;
+						if (!dist[e.to] || *dist[e.to] < d) dist[e.to] = d;
+					}
+				}
+
+				uint64_t pass = 0;
+				for (auto [from, e] : latches) pass = std::max(pass, *dist[from] + g[from].cost + g[from].succ[e].cost);
+
+				std::vector<edge> exits;
+				std::optional<uint64_t> exit;
+				for (size_t n : order) {
+					if (!dist[n]) continue;
+					for (const auto& e : g[n].succ) {
+						if (!body[e.to]) exits.push_back({e.to, *dist[n] + g[n].cost + e.cost, e.bound});
+					}
+					if (g[n].exit) exit = std::max(exit.value_or(0), *dist[n] + g[n].cost + *g[n].exit);
+				}
+				if (exits.empty() && !exit) return "loop at " + where(g[header]) + " never exits";
+
+				node& h = g[header];
+				h.cost = iterations * pass;
+				h.succ = std::move(exits);
+				h.exit = exit;
+				for (size_t n = 0; n < g.size(); ++n) {
+					if (body[n] && n != header) g[n].live = false;
+				}
+
+				// Anything else jumping into the middle of the loop is treated as entering at the top
+				for (auto& n : g) {
+					if (!n.live) continue;
+					for (auto& e : n.succ) if (body[e.to]) e.to = header;
+				}
+				return std::nullopt;
+			}
+
+			static uint64_t longest_path(const std::vector<node>& g) {
+				// Everything is reachable from node 0 and there are no cycles left
+				std::vector<size_t> indegree(g.size(), 0), order{0};
+				for (const auto& n : g) {
+					if (!n.live) continue;
+					for (const auto& e : n.succ) ++indegree[e.to];
+				}
+				for (size_t i = 0; i < order.size(); ++i) {
+					for (const auto& e : g[order[i]].succ) if (--indegree[e.to] == 0) order.push_back(e.to);
+				}
+
+				std::vector<uint64_t> value(g.size(), 0);
+				for (auto it = order.rbegin(); it != order.rend(); ++it) {
+					const node& n = g[*it];
+					uint64_t best = n.exit.value_or(0);
+					for (const auto& e : n.succ) best = std::max(best, e.cost + value[e.to]);
+					value[*it] = n.cost + best;
+				}
+				return value[0];
+			}
+		};
+	}
+
+	void costs::load(const std::string& path) {
+		std::ifstream f(path);
+		if (!f) throw std::runtime_error("unable to open cost table " + path);
+
+		static const char *names[] = {"S", "A", "L", "B", "M", "F", "T"};
+
+		std::string name;
+		uint32_t value;
+		while (f >> name) {
+			if (name[0] == '#') {
+				std::getline(f, name);
+				continue;
+			}
+			if (!(f >> value)) throw std::runtime_error("expected a cycle count for " + name + " in " + path);
+
+			if (name == "taken") taken = value;
+			else if (name == "div") divide = value;
+			else if (name.size() == 2 && name[0] == 'q' && name[1] >= '0' && name[1] <= '3') quadrant[name[1] - '0'] = value;
+			else if (auto it = std::find(std::begin(names), std::end(names), name); it != std::end(names)) encoding[it - std::begin(names)] = value;
+			else throw std::runtime_error("unknown cost " + name + " in " + path);
+		}
+	}
+
+	void report(const parser::pctx& pctx, const layt::lctx& lctx, const costs& c, std::ostream& os) {
+		analysis a;
+		a.build(lctx, c);
+
+		// Entry points: named labels, and section starts that don't have one
+		std::map<uint32_t, std::string> entries;
+		for (const auto& [lbl, name] : pctx.named_labels) {
+			auto it = lctx.evalt.labelvalues.find(lbl);
+			if (it == lctx.evalt.labelvalues.end() || it->second.type != parser::expr::num) continue;
+			std::string& names = entries[(uint32_t)it->second.constant_value];
+			if (!names.empty()) names += ", ";
+			names += pctx.idents.name(name);
+		}
+		for (const auto& section : lctx.sections) {
+			std::string& names = entries[section.base_address];
+			if (names.empty()) names = "(section start)";
+		}
+
+		os << "worst-case cycles:\n";
+		for (const auto& [address, names] : entries) {
+			auto n = a.lookup(address);
+			if (!n) continue;
+
+			const result& r = a.function(*n);
+			char buf[64];
+			snprintf(buf, sizeof buf, "  0x%08x  %-24s  ", address, names.c_str());
+			os << buf;
+			if (r.cycles) os << *r.cycles << "\n";
+			else os << "unbounded: " << r.problem << "\n";
+		}
+	}
+}
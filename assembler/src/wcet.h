@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <ostream>
+#include <string>
+#include "cycles.h"
+#include "layt.h"
+
+namespace masm::wcet {
+	// Cycle costs charged by the analysis. The defaults are derived from cycles.h, for code and data
+	// in block ram (the reset MEM_LAYOUT, with rom and sram in the low quadrants) and a cold
+	// instruction cache: on top of issuing, every instruction waits for each of its halfwords to
+	// come from rom, which mcpu-perf doesn't charge. Other layouts need a cost file, which
+	// overrides them with "name value" lines:
+	//
+	//   S A L B M F T   issuing an instruction with that encoding
+	//   taken           extra for anything that redirects fetch (taken branches, jumps, returns)
+	//   div             extra for div/mod, which wait on the divider
+	//   q0 q1 q2 q3     extra for a load/store to that quadrant (the worst of them is used when
+	//                   the address isn't known statically)
+	struct costs {
+		std::array<uint32_t, 7> encoding = [] {
+			auto e = cycles::issue;
+			for (size_t f = 0; f < e.size(); ++f) e[f] += (f < 2 ? 1 : 2) * cycles::latency[0];
+			return e;
+		}();
+		uint32_t taken = cycles::taken;
+		uint32_t divide = cycles::divide;
+		// rom, sram, cpuregs and vram, past the cycle the access takes anyway
+		std::array<uint32_t, 4> quadrant = {cycles::latency[0] - 1, cycles::latency[1] - 1, cycles::latency[4] - 1, cycles::latency[5] - 1};
+
+		// Throws std::runtime_error if the file can't be read or has unknown names in it
+		void load(const std::string& path);
+	};
+
+	// Work out the worst-case cycle count from every named label and section start (so vectors
+	// placed with .org are covered too) and write a report to os.
+	//
+	// Returns from calls are jumps to r14, and a store to TASK_ACTIVE ends an interrupt handler.
+	// Every loop needs a .bound on its backwards branch; anything that can't be bounded (missing
+	// bounds, computed jumps, recursion) is reported instead of a count.
+	void report(const parser::pctx& pctx, const layt::lctx& lctx, const costs& c, std::ostream& os);
+}
@@ -1,7 +1,180 @@
 /*
 * Various bus-related things
 *
-* Contains various interconnect modules
+* Contains various interconnect modules. Everything speaks the same req/ack protocol as the
+* cpu ports: the master holds req, address and write data until it sees ack.
 */
 
+// Shares one target port between the data and instruction ports; data wins, and an access
+// keeps the port until it is acked.
+module bus_arbiter (
+	input clk,
+	input rst,
 
+	input         d_req,
+	input         d_we,
+	input  [30:0] d_addr,
+	input  [15:0] d_wdata,
+	input  [1:0]  d_wmask,
+	output [15:0] d_rdata,
+	output        d_ack,
+
+	input         i_req,
+	input  [30:0] i_addr,
+	output [15:0] i_rdata,
+	output        i_ack,
+
+	output        t_req,
+	output        t_we,
+	output [30:0] t_addr,
+	output [15:0] t_wdata,
+	output [1:0]  t_wmask,
+	input  [15:0] t_rdata,
+	input         t_ack
+);
+
+	reg locked;
+	reg locked_i;
+
+	wire sel_i = locked ? locked_i : !d_req;
+
+	always @(posedge clk) begin
+		if (rst)
+			locked <= 1'b0;
+		else if (t_ack)
+			locked <= 1'b0;
+		else if (t_req) begin
+			locked   <= 1'b1;
+			locked_i <= sel_i;
+		end
+	end
+
+	assign t_req   = sel_i ? i_req : d_req;
+	assign t_we    = sel_i ? 1'b0 : d_we;
+	assign t_addr  = sel_i ? i_addr : d_addr;
+	assign t_wdata = d_wdata;
+	assign t_wmask = sel_i ? 2'b00 : d_wmask;
+
+	assign d_rdata = t_rdata;
+	assign i_rdata = t_rdata;
+	assign d_ack   = t_ack && !sel_i;
+	assign i_ack   = t_ack && sel_i;
+
+endmodule
+
+// Routes an access to its target by quadrant; the bottom two quadrants go wherever MEM_LAYOUT
+// points them (0 = ROM, 1 = SRAM, 2 = SDRAM, 3 = unmapped).
+module bus_decoder (
+	input  [3:0]  mem_layout,
+
+	input         req,
+	input         we,
+	input  [30:0] addr,
+	input  [15:0] wdata,
+	input  [1:0]  wmask,
+	output [15:0] rdata,
+	output        ack,
+
+	// shared by all targets, only the selected one sees req
+	output [29:0] t_addr,
+	output        t_we,
+	output [15:0] t_wdata,
+	output [1:0]  t_wmask,
+
+	output        rom_req,
+	input  [15:0] rom_rdata,
+	input         rom_ack,
+
+	output        sram_req,
+	input  [15:0] sram_rdata,
+	input         sram_ack,
+
+	output        sdram_req,
+	input  [15:0] sdram_rdata,
+	input         sdram_ack,
+
+	output        io_req,
+	input  [15:0] io_rdata,
+	input         io_ack
+);
+
+	localparam T_ROM      = 3'd0;
+	localparam T_SRAM     = 3'd1;
+	localparam T_SDRAM    = 3'd2;
+	localparam T_UNMAPPED = 3'd3;
+	localparam T_IO       = 3'd4;
+
+	reg [2:0] target;
+	always @* begin
+		case (addr[30:29])
+			2'b00:   target = {1'b0, mem_layout[1:0]};
+			2'b01:   target = {1'b0, mem_layout[3:2]};
+			2'b11:   target = T_IO;
+			// the cpu keeps its own register quadrant to itself
+			default: target = T_UNMAPPED;
+		endcase
+	end
+
+	assign t_addr  = addr[29:0];
+	assign t_we    = we;
+	assign t_wdata = wdata;
+	assign t_wmask = wmask;
+
+	assign rom_req   = req && target == T_ROM;
+	assign sram_req  = req && target == T_SRAM;
+	assign sdram_req = req && target == T_SDRAM;
+	assign io_req    = req && target == T_IO;
+
+	assign rdata =
+		target == T_ROM   ? rom_rdata :
+		target == T_SRAM  ? sram_rdata :
+		target == T_SDRAM ? sdram_rdata :
+		target == T_IO    ? io_rdata :
+		16'b0;
+
+	// unmapped accesses complete straight away
+	assign ack =
+		target == T_ROM   ? rom_ack :
+		target == T_SRAM  ? sram_ack :
+		target == T_SDRAM ? sdram_ack :
+		target == T_IO    ? io_ack :
+		req;
+
+endmodule
+
+// Block ram target; addresses wrap at the size. Takes a cycle to answer.
+module bus_bram #(
+	parameter ADDR_BITS = 15,
+	parameter WRITABLE  = 1,
+	parameter INIT      = ""
+) (
+	input clk,
+
+	input                  req,
+	input                  we,
+	input  [ADDR_BITS-1:0] addr,
+	input  [15:0]          wdata,
+	input  [1:0]           wmask,
+	output reg [15:0]      rdata,
+	output reg             ack
+);
+
+	reg [15:0] mem [0:(1 << ADDR_BITS) - 1];
+
+	initial begin
+		ack = 1'b0;
+		if (INIT != "") $readmemh(INIT, mem);
+	end
+
+	always @(posedge clk) begin
+		ack <= req && !ack;
+		if (req && !ack) begin
+			if (we && WRITABLE) begin
+				if (wmask[0]) mem[addr][7:0]  <= wdata[7:0];
+				if (wmask[1]) mem[addr][15:8] <= wdata[15:8];
+			end
+			rdata <= mem[addr];
+		end
+	end
+
+endmodule
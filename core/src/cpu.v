@@ -0,0 +1,672 @@
+/*
+* MCPU core
+*
+* Bus ports use a simple req/ack handshake on 16-bit bus words: the core holds req (and the
+* address/write data) until the cycle ack is seen; for reads rdata is valid in that cycle.
+* Addresses are word addresses, i.e. the byte address without bit 0.
+*
+* The retire port reports every retired instruction (and interrupt entry) in order, and is
+* what the lockstep simulation in sim/ compares against its reference model.
+*
+* Pipeline: fetch -> decode/register read (on the fetch output) -> EX -> MEM -> WB.
+*  - results are forwarded from MEM and WB into EX; a load stalls its consumer until it reaches WB
+*  - jumps and pc writes resolve in EX and redirect fetch, dropping the one instruction behind
+*  - fetch runs out of its own instruction cache, see fetch.v
+*  - div/mod hold EX for the 33 cycles the divider takes, see div.v
+*  - accesses to the cpu register quadrant (and loads into pc) serialize: nothing issues behind
+*    them and fetch restarts from WB, in whichever task is active by then
+*  - interrupts are entered with the pipeline drained, the retire port reports the entry
+*/
+
+module cpu (
+	input clk,
+	input rst,
+
+	// instruction bus (read only)
+	output        ibus_req,
+	output [30:0] ibus_addr,
+	input  [15:0] ibus_rdata,
+	input         ibus_ack,
+
+	// data bus
+	output        dbus_req,
+	output        dbus_we,
+	output [30:0] dbus_addr,
+	output [15:0] dbus_wdata,
+	output [1:0]  dbus_wmask,
+	input  [15:0] dbus_rdata,
+	input         dbus_ack,
+
+	// current MEM_LAYOUT, for the bus decoder
+	output [3:0]  mem_layout,
+
+	// interrupt request lines, latched on a rising edge
+	input  [15:0] irq,
+
+	// retire port
+	output        retire_valid,
+	output [31:0] retire_pc,
+	output [31:0] retire_next_pc,
+	output [1:0]  retire_task,
+	output        retire_wb,
+	output [3:0]  retire_wb_reg,
+	output [31:0] retire_wb_value,
+	output        retire_irq,
+	output [3:0]  retire_irq_number
+);
+
+	localparam FMT_S = 3'd0;
+	localparam FMT_A = 3'd1;
+	localparam FMT_L = 3'd2;
+	localparam FMT_B = 3'd3;
+	localparam FMT_M = 3'd4;
+	localparam FMT_F = 3'd5;
+	localparam FMT_T = 3'd6;
+
+	localparam DEST_ZEXT  = 2'b00;
+	localparam DEST_SEXT  = 2'b01;
+	localparam DEST_LOWW  = 2'b10;
+	localparam DEST_HIGHW = 2'b11;
+
+	localparam MOV_MIMM = 2'b00;
+	localparam MOV_JUMP = 2'b01;
+	localparam MOV_MRS  = 2'b10;
+	localparam MOV_MRO  = 2'b11;
+
+	// ---------------------------------------------------------------------------------------
+	// pipeline registers (declared up front, the stages refer to each other)
+
+	reg        ex_valid;
+	reg [31:0] ex_pc;
+	reg [1:0]  ex_task;
+	reg        ex_long;
+	reg [6:0]  ex_opcode;
+	reg [2:0]  ex_fmt;
+	reg [3:0]  ex_rd, ex_rs, ex_ro;
+	reg [1:0]  ex_ff;
+	reg [31:0] ex_imm;
+	reg [31:0] ex_ls_imm;
+	reg        ex_use_rd, ex_use_rs, ex_use_ro;
+	reg [31:0] ex_v_rd, ex_v_rs, ex_v_ro;
+
+	reg        mem_valid;
+	reg [31:0] mem_pc;
+	reg [31:0] mem_next_pc;
+	reg [1:0]  mem_task;
+	reg        mem_is_ls;
+	reg        mem_is_store;
+	reg        mem_halfword;
+	reg [1:0]  mem_dest;
+	reg [31:0] mem_addr;
+	reg        mem_internal;
+	reg        mem_serial;
+	reg        mem_wen;
+	reg [3:0]  mem_rd;
+	reg [31:0] mem_v_rd;
+	reg [31:0] mem_result;
+	reg        mem_taken;
+
+	reg        wb_valid;
+	reg [31:0] wb_pc;
+	reg [31:0] wb_next_pc;
+	reg [1:0]  wb_task;
+	reg        wb_rf_we;
+	reg [1:0]  wb_bank;
+	reg [3:0]  wb_reg;
+	reg [31:0] wb_value;
+	reg        wb_report;
+	reg        wb_taken;
+	reg        wb_serial;
+	reg        wb_irq;
+	reg [3:0]  wb_irq_number;
+
+	// ---------------------------------------------------------------------------------------
+	// cpu register block
+
+	wire [31:0] irq_base;
+	wire [15:0] irq_en;
+	wire [1:0]  task_active;
+	wire [15:0] cpuregs_rdata;
+
+	wire        irq_take;
+	wire        f_stalled;
+	wire        mem_ext_wait;
+
+	// the quadrant is 0x8000_0000 - 0x8000_01ff, anything above reads as zero
+	wire        mem_in_block  = mem_addr[29:9] == 21'b0;
+	wire        mem_cpuregs   = mem_valid && mem_is_ls && mem_internal && mem_in_block && !mem_addr[8];
+	wire        mem_task_reg  = mem_valid && mem_is_ls && mem_internal && mem_in_block && mem_addr[8];
+
+	wire [15:0] st_half  = mem_dest == DEST_HIGHW ? mem_v_rd[31:16] : mem_v_rd[15:0];
+	wire [15:0] st_data  = mem_halfword ? st_half : {st_half[7:0], st_half[7:0]};
+	wire [1:0]  st_mask  = mem_halfword ? 2'b11 : (mem_addr[0] ? 2'b10 : 2'b01);
+	wire [15:0] st_bits  = {{8{st_mask[1]}}, {8{st_mask[0]}}};
+
+	cpuregs regs_block (
+		.clk(clk),
+		.rst(rst),
+		.req(mem_cpuregs),
+		.we(mem_is_store),
+		.addr(mem_addr[7:1]),
+		.wdata(st_data),
+		.wmask(st_mask),
+		.rdata(cpuregs_rdata),
+		.irq_enter(irq_take),
+		.ev_retire(wb_valid && !wb_irq),
+		.ev_taken(wb_valid && !wb_irq && wb_taken),
+		.ev_stall(f_stalled || mem_ext_wait),
+		.irq_base(irq_base),
+		.irq_en(irq_en),
+		.task_active(task_active),
+		.mem_layout(mem_layout)
+	);
+
+	// ---------------------------------------------------------------------------------------
+	// interrupts
+
+	reg [15:0] irq_prev;
+	reg [15:0] irq_pending;
+
+	wire [15:0] irq_ready_lines = irq_pending & irq_en;
+	// context 3 is the interrupt context; interrupts never nest
+	wire        irq_ready = |irq_ready_lines && task_active != 2'd3;
+
+	// lowest numbered line wins
+	reg  [3:0]  irq_number;
+	integer n;
+	always @* begin
+		irq_number = 4'd0;
+		for (n = 15; n >= 0; n = n - 1)
+			if (irq_ready_lines[n]) irq_number = n[3:0];
+	end
+
+	wire [31:0] irq_vector = irq_base | {24'b0, irq_number, 4'b0};
+
+	assign irq_take = irq_ready && !ex_valid && !mem_valid && !wb_valid;
+
+	always @(posedge clk) begin
+		if (rst) begin
+			irq_prev    <= 16'b0;
+			irq_pending <= 16'b0;
+		end
+		else begin
+			irq_prev    <= irq;
+			irq_pending <= (irq_pending | (irq & ~irq_prev)) & ~(irq_take ? 16'b1 << irq_number : 16'b0);
+		end
+	end
+
+	// ---------------------------------------------------------------------------------------
+	// register file: {task, reg}; r0 and r15 are never stored here, the pc of each task that
+	// isn't running lives in ctx_pc (the running task's is always that of its oldest instruction)
+
+	reg [31:0] regfile [0:63];
+	reg [31:0] ctx_pc  [0:3];
+
+	integer r;
+	initial begin
+		for (r = 0; r < 64; r = r + 1)
+			regfile[r] = 32'b0;
+	end
+
+	always @(posedge clk) begin
+		if (wb_valid && wb_rf_we && wb_reg != 4'd15)
+			regfile[{wb_bank, wb_reg}] <= wb_value;
+	end
+
+	always @(posedge clk) begin
+		if (rst) begin
+			ctx_pc[0] <= 32'b0;
+			ctx_pc[1] <= 32'b0;
+			ctx_pc[2] <= 32'b0;
+			ctx_pc[3] <= 32'b0;
+		end
+		else begin
+			if (wb_valid && wb_rf_we && wb_reg == 4'd15)
+				ctx_pc[wb_bank] <= wb_value;
+			if (wb_valid && !wb_irq)
+				ctx_pc[wb_task] <= wb_next_pc;
+			if (irq_take)
+				ctx_pc[3] <= irq_vector;
+		end
+	end
+
+	// ---------------------------------------------------------------------------------------
+	// fetch
+
+	wire        redirect;
+	wire [31:0] redirect_pc;
+
+	wire        f_valid;
+	wire [31:0] f_raw;
+	wire [31:0] f_pc;
+	wire        f_ready;
+
+	fetch fetch_unit (
+		.clk(clk),
+		.rst(rst),
+		.redirect(redirect),
+		.redirect_pc(redirect_pc),
+		.ibus_req(ibus_req),
+		.ibus_addr(ibus_addr),
+		.ibus_rdata(ibus_rdata),
+		.ibus_ack(ibus_ack),
+		.snoop(dbus_req && dbus_we && dbus_ack),
+		.snoop_addr(dbus_addr),
+		.flush(mem_cpuregs && mem_is_store && mem_addr[7:1] == 7'h20),
+		.out_valid(f_valid),
+		.out_raw(f_raw),
+		.out_pc(f_pc),
+		.out_ready(f_ready),
+		.stalled(f_stalled)
+	);
+
+	// ---------------------------------------------------------------------------------------
+	// decode & register read
+
+	wire [6:0]  id_opcode = f_raw[6:0];
+	wire        id_long   = f_raw[7];
+	// short instructions are duplicated into both halves, so rd == rs for them
+	wire [31:0] id_word   = id_long ? f_raw : {f_raw[15:0], f_raw[15:0]};
+	wire [3:0]  id_rd     = id_word[31:28];
+	wire [3:0]  id_rs     = id_word[15:12];
+	wire [3:0]  id_ro     = id_word[11:8];
+
+	wire        id_is_ls  = id_opcode[6:5] == 2'b00;
+	wire        id_is_mov = id_opcode[6:5] == 2'b01;
+
+	reg  [2:0]  id_fmt;
+	always @* begin
+		if (id_is_ls)
+			id_fmt = !id_long ? FMT_S : id_opcode[0] ? FMT_F : FMT_T;
+		else if (id_is_mov) begin
+			if (id_opcode[1:0] == MOV_MIMM)
+				id_fmt = id_opcode[4:2] == 3'b111 ? (id_long ? FMT_B : FMT_A) : (id_long ? FMT_L : FMT_S);
+			else
+				id_fmt = id_long ? FMT_T : FMT_S;
+		end
+		else case (id_opcode[1:0])
+			2'b00:   id_fmt = id_long ? FMT_L : FMT_S;
+			2'b01:   id_fmt = id_long ? FMT_M : FMT_A;
+			default: id_fmt = id_long ? FMT_T : FMT_S;
+		endcase
+	end
+
+	reg  [31:0] id_imm;
+	reg  [1:0]  id_ff;
+	always @* begin
+		id_ff = 2'b00;
+		case (id_fmt)
+			FMT_A:   id_imm = {{28{id_word[11]}}, id_word[11:8]};
+			FMT_L:   id_imm = {{20{id_word[27]}}, id_word[27:16]};
+			FMT_B:   id_imm = {{12{id_word[27]}}, id_word[27:8]};
+			FMT_M:   id_imm = {{16{id_word[27]}}, id_word[27:12]};
+			FMT_F: begin
+				id_imm = {{18{id_word[27]}}, id_word[27:14]};
+				id_ff  = id_word[13:12];
+			end
+			FMT_T: begin
+				id_imm = {{22{id_word[27]}}, id_word[27:18]};
+				id_ff  = id_word[17:16];
+			end
+			default: id_imm = 32'b0;
+		endcase
+	end
+
+	// F addresses take their top two bits from FF, T addresses scale rs by it
+	wire [31:0] id_ls_imm = id_fmt == FMT_F ? {id_ff, id_imm[29:0]} : id_fmt == FMT_T ? id_imm : 32'b0;
+
+	// which operands the instruction actually reads, for load-use stalls
+	reg id_use_rd, id_use_rs, id_use_ro;
+	always @* begin
+		if (id_is_ls) begin
+			id_use_ro = 1'b1;
+			id_use_rs = id_fmt == FMT_T;
+			id_use_rd = id_opcode[4] || id_opcode[2];
+		end
+		else if (id_is_mov) begin
+			id_use_ro = 1'b1;
+			id_use_rs = 1'b1;
+			id_use_rd = id_opcode[1:0] == MOV_JUMP;
+		end
+		else begin
+			id_use_rd = 1'b0;
+			id_use_rs = id_fmt != FMT_M;
+			id_use_ro = id_fmt != FMT_A;
+		end
+	end
+
+	// register reads see the write happening in WB this cycle
+	wire id_wb_hit_rd = wb_valid && wb_rf_we && wb_bank == task_active && wb_reg == id_rd;
+	wire id_wb_hit_rs = wb_valid && wb_rf_we && wb_bank == task_active && wb_reg == id_rs;
+	wire id_wb_hit_ro = wb_valid && wb_rf_we && wb_bank == task_active && wb_reg == id_ro;
+
+	wire [31:0] id_v_rd = id_rd == 4'd0 ? 32'b0 : id_rd == 4'd15 ? f_pc : id_wb_hit_rd ? wb_value : regfile[{task_active, id_rd}];
+	wire [31:0] id_v_rs = id_rs == 4'd0 ? 32'b0 : id_rs == 4'd15 ? f_pc : id_wb_hit_rs ? wb_value : regfile[{task_active, id_rs}];
+	wire [31:0] id_v_ro = id_ro == 4'd0 ? 32'b0 : id_ro == 4'd15 ? f_pc : id_wb_hit_ro ? wb_value : regfile[{task_active, id_ro}];
+
+	// ---------------------------------------------------------------------------------------
+	// EX
+
+	wire ex_is_ls  = ex_opcode[6:5] == 2'b00;
+	wire ex_is_mov = ex_opcode[6:5] == 2'b01;
+	wire ex_is_alu = ex_opcode[6];
+
+	// forwarding: MEM (anything but a load, which stalls instead) then WB
+	wire mem_fwd     = mem_valid && mem_wen && !mem_is_ls;
+	wire mem_hit_rd  = mem_fwd && mem_rd == ex_rd;
+	wire mem_hit_rs  = mem_fwd && mem_rd == ex_rs;
+	wire mem_hit_ro  = mem_fwd && mem_rd == ex_ro;
+	wire wb_hit_rd   = wb_valid && wb_rf_we && wb_bank == ex_task && wb_reg == ex_rd && ex_rd != 4'd0 && ex_rd != 4'd15;
+	wire wb_hit_rs   = wb_valid && wb_rf_we && wb_bank == ex_task && wb_reg == ex_rs && ex_rs != 4'd0 && ex_rs != 4'd15;
+	wire wb_hit_ro   = wb_valid && wb_rf_we && wb_bank == ex_task && wb_reg == ex_ro && ex_ro != 4'd0 && ex_ro != 4'd15;
+
+	wire [31:0] ex_op_rd = mem_hit_rd ? mem_result : wb_hit_rd ? wb_value : ex_v_rd;
+	wire [31:0] ex_op_rs = mem_hit_rs ? mem_result : wb_hit_rs ? wb_value : ex_v_rs;
+	wire [31:0] ex_op_ro = mem_hit_ro ? mem_result : wb_hit_ro ? wb_value : ex_v_ro;
+
+	wire mem_load = mem_valid && mem_wen && mem_is_ls;
+	wire load_stall = mem_load && (
+		(ex_use_rd && mem_rd == ex_rd) ||
+		(ex_use_rs && mem_rd == ex_rs) ||
+		(ex_use_ro && mem_rd == ex_ro)
+	);
+
+	// alu
+	reg [31:0] alu_a, alu_b, alu_out;
+	wire [2:0] ex_shift = {1'b0, ex_ff} + 3'd1;
+
+	wire [63:0] mul_full = $signed(alu_a) * $signed(alu_b);
+
+	// div/mod start the divider once their operands are ready and wait in EX for it
+	wire        ex_is_div = ex_is_alu && ex_opcode[5] && ex_opcode[3:2] == 2'b11;
+	wire        div_busy, div_done;
+	wire [31:0] div_quotient, div_remainder;
+	reg         div_ready;
+
+	div divider (
+		.clk(clk),
+		.rst(rst),
+		.start(ex_valid && ex_is_div && !div_ready && !div_done && !load_stall),
+		.a(alu_a),
+		.b(alu_b),
+		.busy(div_busy),
+		.done(div_done),
+		.quotient(div_quotient),
+		.remainder(div_remainder)
+	);
+
+	wire div_wait = ex_is_div && !div_ready && !div_done;
+
+	always @* begin
+		case (ex_opcode[1:0])
+			2'b00: begin
+				alu_a = ex_op_rs;
+				alu_b = ex_op_ro;
+			end
+			2'b01: begin
+				alu_a = ex_fmt == FMT_A ? ex_op_rs : ex_op_ro;
+				alu_b = ex_imm;
+			end
+			2'b10: begin
+				alu_a = ex_op_rs;
+				alu_b = ex_op_ro << ex_shift;
+			end
+			default: begin
+				alu_a = ex_op_rs;
+				alu_b = ex_op_ro >> ex_shift;
+			end
+		endcase
+
+		case (ex_opcode[5:2])
+			4'b0000: alu_out = alu_a + alu_b;
+			4'b0001: alu_out = alu_a - alu_b;
+			4'b0010,
+			4'b0100: alu_out = alu_a << alu_b[4:0];
+			4'b0011: alu_out = $signed(alu_a) >>> alu_b[4:0];
+			4'b0101: alu_out = alu_a >> alu_b[4:0];
+			4'b0110: alu_out = mul_full[31:0];
+			4'b0111: alu_out = mul_full[63:32];
+			4'b1000: alu_out = alu_a | alu_b;
+			4'b1001: alu_out = alu_a ^ alu_b;
+			4'b1010: alu_out = alu_a & alu_b;
+			4'b1100: alu_out = ~(alu_a | alu_b);
+			4'b1101: alu_out = ~(alu_a ^ alu_b);
+			4'b1110: alu_out = ~(alu_a & alu_b);
+			4'b1011: alu_out = div_quotient;
+			4'b1111: alu_out = div_remainder;
+		endcase
+	end
+
+	// mov/jmp
+	wire [31:0] mov_op1 = ex_ff == 2'b01 ? ex_imm : ex_op_rs;
+	wire [31:0] mov_op2 = ex_ff == 2'b10 ? ex_imm : ex_op_ro;
+
+	reg mov_cond;
+	always @* begin
+		case (ex_opcode[4:2])
+			3'b000: mov_cond = mov_op1 < mov_op2;
+			3'b001: mov_cond = $signed(mov_op1) < $signed(mov_op2);
+			3'b010: mov_cond = mov_op1 >= mov_op2;
+			3'b011: mov_cond = $signed(mov_op1) >= $signed(mov_op2);
+			3'b100: mov_cond = mov_op1 == mov_op2;
+			3'b101: mov_cond = mov_op1 != mov_op2;
+			3'b110: mov_cond = |(mov_op1 & mov_op2);
+			default: mov_cond = 1'b1;
+		endcase
+	end
+
+	reg [31:0] mov_value;
+	always @* begin
+		case (ex_opcode[1:0])
+			MOV_MIMM: mov_value = ex_imm;
+			MOV_JUMP: mov_value = ex_op_rd;
+			MOV_MRS:  mov_value = ex_op_rs;
+			default:  mov_value = ex_op_ro;
+		endcase
+		if (ex_ff == 2'b11) mov_value = mov_value + ex_imm;
+	end
+
+	wire [31:0] ex_result = ex_is_alu ? alu_out : mov_value;
+	// has a value for rd (loads are handled in MEM)
+	wire        ex_dest   = ex_is_alu || (ex_is_mov && mov_cond && ex_opcode[1:0] != MOV_JUMP);
+	wire        ex_taken  = (ex_is_mov && mov_cond && ex_opcode[1:0] == MOV_JUMP) || (ex_dest && ex_rd == 4'd15);
+	wire [31:0] ex_next_pc = ex_taken ? ex_result : ex_pc + (ex_long ? 32'd4 : 32'd2);
+
+	// load/store
+	wire        ex_store    = ex_opcode[4];
+	wire [31:0] ex_addr     = ex_ls_imm + ex_op_ro + (ex_fmt == FMT_T ? ex_op_rs << ex_ff : 32'b0);
+	wire        ex_internal = ex_addr[31:30] == 2'b10;
+	wire        ex_serial   = ex_is_ls && (ex_internal || (!ex_store && ex_rd == 4'd15));
+
+	wire        ex_wen = ex_is_ls ? (!ex_store && ex_rd != 4'd0 && ex_rd != 4'd15) : (ex_dest && ex_rd != 4'd0 && ex_rd != 4'd15);
+
+	// ---------------------------------------------------------------------------------------
+	// MEM
+
+	wire        mem_ext  = mem_valid && mem_is_ls && !mem_internal;
+	wire        mem_done = !mem_ext || dbus_ack;
+	assign      mem_ext_wait = mem_ext && !dbus_ack;
+
+	assign dbus_req   = mem_ext;
+	assign dbus_we    = mem_is_store;
+	assign dbus_addr  = mem_addr[31:1];
+	assign dbus_wdata = st_data;
+	assign dbus_wmask = st_mask;
+
+	// task context registers, 0x40 bytes per task
+	wire [1:0]  tr_task  = mem_addr[7:6];
+	wire [3:0]  tr_reg   = mem_addr[5:2];
+	wire        tr_wb_hit = wb_valid && wb_rf_we && wb_bank == tr_task && wb_reg == tr_reg;
+	wire [31:0] tr_value =
+		tr_reg == 4'd0  ? 32'b0 :
+		tr_reg == 4'd15 ? (tr_task == mem_task ? mem_pc : ctx_pc[tr_task]) :
+		tr_wb_hit       ? wb_value :
+		regfile[{tr_task, tr_reg}];
+	wire [15:0] tr_old    = mem_addr[1] ? tr_value[31:16] : tr_value[15:0];
+	wire [15:0] tr_new    = (tr_old & ~st_bits) | (st_data & st_bits);
+	wire [31:0] tr_merged = mem_addr[1] ? {tr_new, tr_value[15:0]} : {tr_value[31:16], tr_new};
+
+	wire [15:0] int_rdata = mem_task_reg ? tr_old : mem_cpuregs ? cpuregs_rdata : 16'b0;
+
+	wire [15:0] ld_word = mem_internal ? int_rdata : dbus_rdata;
+	wire [7:0]  ld_byte = mem_addr[0] ? ld_word[15:8] : ld_word[7:0];
+	wire [15:0] ld_val  = mem_halfword ? ld_word : {8'b0, ld_byte};
+
+	reg [31:0] ld_result;
+	always @* begin
+		case (mem_dest)
+			DEST_ZEXT:  ld_result = {16'b0, ld_val};
+			DEST_SEXT:  ld_result = mem_halfword ? {{16{ld_word[15]}}, ld_word} : {{24{ld_byte[7]}}, ld_byte};
+			DEST_LOWW:  ld_result = {mem_v_rd[31:16], ld_val};
+			default:    ld_result = {ld_val, mem_v_rd[15:0]};
+		endcase
+	end
+
+	wire mem_load_pc = mem_is_ls && !mem_is_store && mem_rd == 4'd15;
+
+	// ---------------------------------------------------------------------------------------
+	// WB / redirects / issue
+
+	wire        wb_redirect    = wb_valid && wb_serial;
+	wire [31:0] wb_redirect_pc = task_active != wb_task ? ctx_pc[task_active] : wb_next_pc;
+
+	wire mem_free    = !mem_valid || mem_done;
+	wire ex_go       = ex_valid && mem_free && !load_stall && !div_wait;
+	wire ex_redirect = ex_go && ex_taken;
+
+	assign redirect    = ex_redirect || wb_redirect || irq_take;
+	assign redirect_pc = irq_take ? irq_vector : wb_redirect ? wb_redirect_pc : ex_result;
+
+	wire hold = irq_ready || ex_redirect || (ex_go && ex_serial) || (mem_valid && mem_serial) || wb_redirect;
+	wire issue = f_valid && (!ex_valid || ex_go) && !hold;
+	assign f_ready = issue;
+
+	always @(posedge clk) begin
+		if (rst) begin
+			ex_valid  <= 1'b0;
+			mem_valid <= 1'b0;
+			wb_valid  <= 1'b0;
+			div_ready <= 1'b0;
+		end
+		else begin
+			// the divider's results stay put until the div/mod waiting on them moves on
+			if (ex_go) div_ready <= 1'b0;
+			else if (div_done) div_ready <= 1'b1;
+
+			// ID -> EX
+			if (issue) begin
+				ex_valid  <= 1'b1;
+				ex_pc     <= f_pc;
+				ex_task   <= task_active;
+				ex_long   <= id_long;
+				ex_opcode <= id_opcode;
+				ex_fmt    <= id_fmt;
+				ex_rd     <= id_rd;
+				ex_rs     <= id_rs;
+				ex_ro     <= id_ro;
+				ex_ff     <= id_ff;
+				ex_imm    <= id_imm;
+				ex_ls_imm <= id_ls_imm;
+				ex_use_rd <= id_use_rd;
+				ex_use_rs <= id_use_rs;
+				ex_use_ro <= id_use_ro;
+				ex_v_rd   <= id_v_rd;
+				ex_v_rs   <= id_v_rs;
+				ex_v_ro   <= id_v_ro;
+			end
+			else if (ex_go)
+				ex_valid <= 1'b0;
+			else if (ex_valid) begin
+				// keep up with forwarded values while stalled, their producers move on
+				ex_v_rd <= ex_op_rd;
+				ex_v_rs <= ex_op_rs;
+				ex_v_ro <= ex_op_ro;
+			end
+
+			// EX -> MEM
+			if (ex_go) begin
+				mem_valid    <= 1'b1;
+				mem_pc       <= ex_pc;
+				mem_next_pc  <= ex_next_pc;
+				mem_task     <= ex_task;
+				mem_is_ls    <= ex_is_ls;
+				mem_is_store <= ex_is_ls && ex_store;
+				mem_halfword <= ex_opcode[3];
+				mem_dest     <= ex_opcode[2:1];
+				mem_addr     <= ex_addr;
+				mem_internal <= ex_is_ls && ex_internal;
+				mem_serial   <= ex_serial;
+				mem_wen      <= ex_wen;
+				mem_rd       <= ex_rd;
+				mem_v_rd     <= ex_op_rd;
+				mem_result   <= ex_result;
+				mem_taken    <= ex_taken;
+			end
+			else if (mem_done)
+				mem_valid <= 1'b0;
+
+			// MEM -> WB
+			if (mem_valid && mem_done) begin
+				wb_valid      <= 1'b1;
+				wb_pc         <= mem_pc;
+				wb_task       <= mem_task;
+				wb_serial     <= mem_serial;
+				wb_irq        <= 1'b0;
+				wb_irq_number <= 4'd0;
+
+				if (mem_load_pc) begin
+					wb_next_pc <= ld_result;
+					wb_taken   <= 1'b1;
+				end
+				else begin
+					wb_next_pc <= mem_next_pc;
+					wb_taken   <= mem_taken;
+				end
+
+				if (mem_task_reg && mem_is_store) begin
+					wb_rf_we  <= tr_reg != 4'd0;
+					wb_bank   <= tr_task;
+					wb_reg    <= tr_reg;
+					wb_value  <= tr_merged;
+					wb_report <= 1'b0;
+				end
+				else begin
+					wb_rf_we  <= mem_wen;
+					wb_bank   <= mem_task;
+					wb_reg    <= mem_rd;
+					wb_value  <= mem_is_ls ? ld_result : mem_result;
+					wb_report <= mem_wen;
+				end
+			end
+			else if (irq_take) begin
+				// interrupt entry retires like an instruction that sets r14 in context 3
+				wb_valid      <= 1'b1;
+				wb_pc         <= ctx_pc[task_active];
+				wb_next_pc    <= irq_vector;
+				wb_task       <= task_active;
+				wb_serial     <= 1'b0;
+				wb_irq        <= 1'b1;
+				wb_irq_number <= irq_number;
+				wb_taken      <= 1'b1;
+				wb_rf_we      <= 1'b1;
+				wb_bank       <= 2'd3;
+				wb_reg        <= 4'd14;
+				wb_value      <= {30'b0, task_active};
+				wb_report     <= 1'b0;
+			end
+			else
+				wb_valid <= 1'b0;
+		end
+	end
+
+	assign retire_valid      = wb_valid;
+	assign retire_pc         = wb_pc;
+	assign retire_next_pc    = wb_next_pc;
+	assign retire_task       = wb_task;
+	assign retire_wb         = wb_report;
+	assign retire_wb_reg     = wb_reg;
+	assign retire_wb_value   = wb_value;
+	assign retire_irq        = wb_irq;
+	assign retire_irq_number = wb_irq_number;
+
+endmodule
@@ -0,0 +1,114 @@
+/*
+* CPU-internal register block (0x8000_0000 - 0x8000_00ff)
+*
+* Holds the interrupt, task and memory layout registers and the per-task performance counters.
+* The task context registers (0x8000_0100 onwards) live in the register file instead.
+*/
+
+module cpuregs (
+	input clk,
+	input rst,
+
+	// access port, one bus word wide; addr is the byte offset into the block
+	input             req,
+	input             we,
+	input      [7:1]  addr,
+	input      [15:0] wdata,
+	input      [1:0]  wmask,
+	output reg [15:0] rdata,
+
+	// interrupt entry, switches to task context 3
+	input             irq_enter,
+
+	// performance events, counted against the active task
+	input             ev_retire,
+	input             ev_taken,
+	input             ev_stall,
+
+	output reg [31:0] irq_base,
+	output reg [15:0] irq_en,
+	output reg [1:0]  task_active,
+	output reg [3:0]  mem_layout
+);
+
+	localparam PERF_CYCLES  = 2'd0;
+	localparam PERF_RETIRED = 2'd1;
+	localparam PERF_TAKEN   = 2'd2;
+	localparam PERF_STALL   = 2'd3;
+
+	// counters[{task, n}]
+	reg [63:0] counters [0:15];
+
+	// reading the low word of a counter latches the rest so the whole 64 bits are consistent
+	reg [47:0] count_shadow;
+	// IRQ_BASE only updates on a write to its high word
+	reg [15:0] irq_base_shadow;
+
+	wire       is_counter   = addr[7];
+	wire [3:0] counter_sel  = addr[6:3];
+	wire [1:0] counter_word = addr[2:1];
+
+	wire [15:0] wmask_bits = {{8{wmask[1]}}, {8{wmask[0]}}};
+
+	always @* begin
+		rdata = 16'b0;
+		if (is_counter) begin
+			case (counter_word)
+				2'd0: rdata = counters[counter_sel][15:0];
+				2'd1: rdata = count_shadow[15:0];
+				2'd2: rdata = count_shadow[31:16];
+				2'd3: rdata = count_shadow[47:32];
+			endcase
+		end
+		else case ({addr, 1'b0})
+			8'h00: rdata = irq_base[15:0];
+			8'h02: rdata = irq_base[31:16];
+			8'h04: rdata = irq_en;
+			8'h10: rdata = {14'b0, task_active};
+			8'h40: rdata = {12'b0, mem_layout};
+			default: rdata = 16'b0;
+		endcase
+	end
+
+	integer i;
+
+	always @(posedge clk) begin
+		if (rst) begin
+			irq_base        <= 32'b0;
+			irq_base_shadow <= 16'b0;
+			irq_en          <= 16'b0;
+			task_active     <= 2'd0;
+			mem_layout      <= 4'b0100;
+			count_shadow    <= 48'b0;
+			for (i = 0; i < 16; i = i + 1)
+				counters[i] <= 64'b0;
+		end
+		else begin
+			counters[{task_active, PERF_CYCLES}] <= counters[{task_active, PERF_CYCLES}] + 64'd1;
+			if (ev_retire) counters[{task_active, PERF_RETIRED}] <= counters[{task_active, PERF_RETIRED}] + 64'd1;
+			if (ev_taken)  counters[{task_active, PERF_TAKEN}]   <= counters[{task_active, PERF_TAKEN}] + 64'd1;
+			if (ev_stall)  counters[{task_active, PERF_STALL}]   <= counters[{task_active, PERF_STALL}] + 64'd1;
+
+			if (req && !we && is_counter && counter_word == 2'd0)
+				count_shadow <= counters[counter_sel][63:16];
+
+			if (req && we && !is_counter) begin
+				case ({addr, 1'b0})
+					8'h00: irq_base_shadow <= (irq_base_shadow & ~wmask_bits) | (wdata & wmask_bits);
+					8'h02: irq_base        <= {(irq_base[31:16] & ~wmask_bits) | (wdata & wmask_bits), irq_base_shadow};
+					8'h04: irq_en          <= (irq_en & ~wmask_bits) | (wdata & wmask_bits);
+					8'h10: if (wmask[0]) task_active <= wdata[1:0];
+					8'h40: if (wmask[0]) mem_layout  <= wdata[3:0];
+					8'h50:
+						// PERF_RESET: each set bit clears counter {task, n}
+						for (i = 0; i < 16; i = i + 1)
+							if (wdata[i] && wmask_bits[i]) counters[i] <= 64'b0;
+					default: ;
+				endcase
+			end
+
+			if (irq_enter) task_active <= 2'd3;
+		end
+	end
+
+endmodule
@@ -0,0 +1,63 @@
+/*
+* Iterative signed divider for div/mod, one quotient bit per cycle
+*
+* start latches the operands (it is ignored while busy); 33 cycles later done goes high for a
+* single cycle with both results valid, and they stay valid until the next start. Division
+* rounds towards zero and the remainder takes the sign of the dividend. Dividing by zero gives
+* a quotient of -1 and the dividend as remainder; 0x8000_0000 / -1 gives 0x8000_0000 rem 0.
+*/
+
+module div (
+	input clk,
+	input rst,
+
+	input             start,
+	input      [31:0] a,
+	input      [31:0] b,
+
+	output            busy,
+	output reg        done,
+	output     [31:0] quotient,
+	output     [31:0] remainder
+);
+
+	reg [5:0]  count;
+	reg [31:0] q, r, d;
+	reg        neg_q, neg_r, by_zero;
+
+	assign busy = count != 6'd0;
+
+	// one restoring step: shift the next dividend bit into the partial remainder
+	wire [32:0] r_shifted = {r, q[31]};
+	wire [32:0] r_diff    = r_shifted - {1'b0, d};
+	wire        r_fits    = !r_diff[32];
+
+	assign quotient  = by_zero ? 32'hffff_ffff : neg_q ? -q : q;
+	assign remainder = neg_r ? -r : r;
+
+	always @(posedge clk) begin
+		if (rst) begin
+			count <= 6'd0;
+			done  <= 1'b0;
+		end
+		else begin
+			done <= 1'b0;
+			if (start && !busy) begin
+				count   <= 6'd32;
+				q       <= a[31] ? -a : a;
+				r       <= 32'b0;
+				d       <= b[31] ? -b : b;
+				neg_q   <= a[31] ^ b[31];
+				neg_r   <= a[31];
+				by_zero <= b == 32'b0;
+			end
+			else if (busy) begin
+				count <= count - 6'd1;
+				q     <= {q[30:0], r_fits};
+				r     <= r_fits ? r_diff[31:0] : r_shifted[31:0];
+				done  <= count == 6'd1;
+			end
+		end
+	end
+
+endmodule
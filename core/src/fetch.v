@@ -0,0 +1,196 @@
+/*
+* Instruction fetch
+*
+* A direct-mapped instruction cache (16 byte lines) feeds a queue of halfwords, from which the
+* next instruction is cut out whether it is short or long and however it sits relative to the
+* 32-bit words the cache delivers. What the cache returns in a cycle can go straight to the
+* output if the queue is empty, so a redirect that hits costs a single cycle.
+*
+* Lines are filled from the start, a bus word at a time. Stores on the data bus invalidate the
+* line they fall in, and a MEM_LAYOUT change flushes everything, but instructions already
+* fetched are not refetched: code that modifies itself has to jump to the new code.
+*/
+
+module fetch #(
+	parameter INDEX_BITS = 6
+) (
+	input clk,
+	input rst,
+
+	input             redirect,
+	input      [31:0] redirect_pc,
+
+	output            ibus_req,
+	output     [30:0] ibus_addr,
+	input      [15:0] ibus_rdata,
+	input             ibus_ack,
+
+	// stores on the data bus (word address), and MEM_LAYOUT writes
+	input             snoop,
+	input      [30:0] snoop_addr,
+	input             flush,
+
+	// fetched instruction; long instructions have the first halfword in out_raw[15:0]
+	output reg        out_valid,
+	output reg [31:0] out_raw,
+	output reg [31:0] out_pc,
+	input             out_ready,
+
+	// waiting on the bus for an instruction the pipeline wants
+	output            stalled
+);
+
+	localparam LINES    = 1 << INDEX_BITS;
+	localparam TAG_BITS = 28 - INDEX_BITS;
+
+	// ---------------------------------------------------------------------------------------
+	// cache
+
+	reg [LINES-1:0]    valid;
+	reg [TAG_BITS-1:0] tags    [0:LINES-1];
+	// even and odd halfwords of each 32-bit word, so a lookup reads a whole word
+	reg [15:0]         data_lo [0:LINES*4-1];
+	reg [15:0]         data_hi [0:LINES*4-1];
+
+	// next word to look up; skip_half when a redirect landed on its second halfword
+	reg [31:0] fpc;
+	reg        skip_half;
+
+	wire [INDEX_BITS-1:0] f_index = fpc[INDEX_BITS+3:4];
+	wire [TAG_BITS-1:0]   f_tag   = fpc[31:INDEX_BITS+4];
+	wire [INDEX_BITS+1:0] f_slot  = fpc[INDEX_BITS+3:2];
+
+	wire        hit  = valid[f_index] && tags[f_index] == f_tag;
+	wire [15:0] f_lo = data_lo[f_slot];
+	wire [15:0] f_hi = data_hi[f_slot];
+
+	// line fill
+	reg        fill_active;
+	reg        fill_abort;   // redirected elsewhere, stop after the access in flight
+	reg        fill_poison;  // invalidated while filling, don't mark it valid
+	reg [27:0] fill_line;
+	reg [2:0]  fill_off;
+
+	wire [INDEX_BITS-1:0] fill_index = fill_line[INDEX_BITS-1:0];
+
+	assign ibus_req  = fill_active;
+	assign ibus_addr = {fill_line, fill_off};
+
+	// ---------------------------------------------------------------------------------------
+	// queue & instruction extraction
+
+	localparam DEPTH = 8;
+
+	reg [15:0] queue [0:DEPTH-1];
+	reg [2:0]  q_head, q_tail;
+	reg [3:0]  q_count;
+	// address of the halfword at the head of the queue
+	reg [31:0] qpc;
+
+	// only look up when the whole word fits
+	wire        lookup   = q_count <= 4'd6;
+	wire        look_hit = lookup && hit && !redirect;
+	wire [1:0]  look_n   = !look_hit ? 2'd0 : skip_half ? 2'd1 : 2'd2;
+	wire [15:0] look0    = skip_half ? f_hi : f_lo;
+	wire [15:0] look1    = f_hi;
+
+	// the first two halfwords of (queue, this lookup)
+	wire [15:0] h0 = q_count != 4'd0 ? queue[q_head] : look0;
+	wire [15:0] h1 = q_count >= 4'd2 ? queue[q_head + 3'd1] : q_count == 4'd1 ? look0 : look1;
+
+	wire [3:0]  avail     = q_count + {2'b0, look_n};
+	wire [1:0]  ilen      = h0[7] ? 2'd2 : 2'd1;
+	wire        take      = (!out_valid || out_ready) && !redirect && avail >= {2'b0, ilen};
+	wire [1:0]  from_q    = !take ? 2'd0 : q_count >= {2'b0, ilen} ? ilen : q_count[1:0];
+	wire [1:0]  from_look = take ? ilen - from_q : 2'd0;
+	wire [1:0]  n_push    = look_n - from_look;
+	wire [15:0] push0     = from_look == 2'd0 ? look0 : look1;
+
+	wire fill_start = lookup && !hit && !fill_active && !redirect;
+
+	assign stalled = fill_active && !fill_abort && !out_valid && q_count == 4'd0;
+
+	always @(posedge clk) begin
+		if (n_push != 2'd0) queue[q_tail] <= push0;
+		if (n_push == 2'd2) queue[q_tail + 3'd1] <= look1;
+	end
+
+	always @(posedge clk) begin
+		if (fill_active && ibus_ack) begin
+			if (fill_off[0]) data_hi[{fill_index, fill_off[2:1]}] <= ibus_rdata;
+			else             data_lo[{fill_index, fill_off[2:1]}] <= ibus_rdata;
+			if (fill_off == 3'd7) tags[fill_index] <= fill_line[27:INDEX_BITS];
+		end
+	end
+
+	always @(posedge clk) begin
+		if (rst) begin
+			valid       <= {LINES{1'b0}};
+			fpc         <= 32'b0;
+			skip_half   <= 1'b0;
+			qpc         <= 32'b0;
+			q_head      <= 3'd0;
+			q_tail      <= 3'd0;
+			q_count     <= 4'd0;
+			fill_active <= 1'b0;
+			out_valid   <= 1'b0;
+		end
+		else begin
+			// queue & output
+			q_tail  <= q_tail + {1'b0, n_push};
+			q_head  <= q_head + {1'b0, from_q};
+			q_count <= q_count + {2'b0, n_push} - {2'b0, from_q};
+
+			if (take) begin
+				out_valid <= 1'b1;
+				out_raw   <= ilen == 2'd2 ? {h1, h0} : {16'b0, h0};
+				out_pc    <= qpc;
+				qpc       <= qpc + (ilen == 2'd2 ? 32'd4 : 32'd2);
+			end
+			else if (out_ready)
+				out_valid <= 1'b0;
+
+			if (look_hit) begin
+				fpc       <= fpc + 32'd4;
+				skip_half <= 1'b0;
+			end
+
+			// fills
+			if (fill_start) begin
+				fill_active <= 1'b1;
+				fill_abort  <= 1'b0;
+				fill_poison <= 1'b0;
+				fill_line   <= fpc[31:4];
+				fill_off    <= 3'd0;
+				valid[f_index] <= 1'b0;
+			end
+			else if (fill_active && ibus_ack) begin
+				fill_off <= fill_off + 3'd1;
+				if (fill_off == 3'd7 || fill_abort) fill_active <= 1'b0;
+				if (fill_off == 3'd7 && !fill_abort && !fill_poison) valid[fill_index] <= 1'b1;
+			end
+
+			if (snoop) begin
+				valid[snoop_addr[INDEX_BITS+2:3]] <= 1'b0;
+				if (fill_active && snoop_addr[INDEX_BITS+2:3] == fill_index) fill_poison <= 1'b1;
+			end
+
+			if (flush) begin
+				valid <= {LINES{1'b0}};
+				if (fill_active) fill_poison <= 1'b1;
+			end
+
+			if (redirect) begin
+				fpc       <= {redirect_pc[31:2], 2'b00};
+				skip_half <= redirect_pc[1];
+				qpc       <= redirect_pc;
+				q_head    <= 3'd0;
+				q_tail    <= 3'd0;
+				q_count   <= 4'd0;
+				out_valid <= 1'b0;
+				if (fill_active && redirect_pc[31:4] != fill_line) fill_abort <= 1'b1;
+			end
+		end
+	end
+
+endmodule
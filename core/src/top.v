@@ -1,23 +1,174 @@
-module top (
+module top #(
+	// $readmemh image for the boot rom
+	parameter ROM_INIT = ""
+) (
     input  clk,
     output [7:0] cathodes,
 	output [7:0] anodes
 );
 
-    localparam BITS = 32;
-    localparam LOG2DELAY = 20;
-
     wire bufg_clk;
     BUFG bufgctrl(.I(clk), .O(bufg_clk));
 
-	reg [BITS+LOG2DELAY-1:0] counter = 0;
+	// hold the core in reset for a little while after configuration
+	reg [3:0] rst_count = 0;
+	wire rst = rst_count != 4'hf;
 
 	always @(posedge bufg_clk)
-		counter <= counter + 1;
+		if (rst) rst_count <= rst_count + 1;
+
+	// cpu
+
+	wire        ibus_req, ibus_ack;
+	wire [30:0] ibus_addr;
+	wire [15:0] ibus_rdata;
+
+	wire        dbus_req, dbus_we, dbus_ack;
+	wire [30:0] dbus_addr;
+	wire [15:0] dbus_wdata, dbus_rdata;
+	wire [1:0]  dbus_wmask;
+
+	wire [3:0]  mem_layout;
+
+	cpu core (
+		.clk(bufg_clk),
+		.rst(rst),
+		.ibus_req(ibus_req),
+		.ibus_addr(ibus_addr),
+		.ibus_rdata(ibus_rdata),
+		.ibus_ack(ibus_ack),
+		.dbus_req(dbus_req),
+		.dbus_we(dbus_we),
+		.dbus_addr(dbus_addr),
+		.dbus_wdata(dbus_wdata),
+		.dbus_wmask(dbus_wmask),
+		.dbus_rdata(dbus_rdata),
+		.dbus_ack(dbus_ack),
+		.mem_layout(mem_layout),
+		.irq(16'b0),
+		.retire_valid(),
+		.retire_pc(),
+		.retire_next_pc(),
+		.retire_task(),
+		.retire_wb(),
+		.retire_wb_reg(),
+		.retire_wb_value(),
+		.retire_irq(),
+		.retire_irq_number()
+	);
+
+	// interconnect
+
+	wire        bus_req, bus_we, bus_ack;
+	wire [30:0] bus_addr;
+	wire [15:0] bus_wdata, bus_rdata;
+	wire [1:0]  bus_wmask;
+
+	bus_arbiter arbiter (
+		.clk(bufg_clk),
+		.rst(rst),
+		.d_req(dbus_req),
+		.d_we(dbus_we),
+		.d_addr(dbus_addr),
+		.d_wdata(dbus_wdata),
+		.d_wmask(dbus_wmask),
+		.d_rdata(dbus_rdata),
+		.d_ack(dbus_ack),
+		.i_req(ibus_req),
+		.i_addr(ibus_addr),
+		.i_rdata(ibus_rdata),
+		.i_ack(ibus_ack),
+		.t_req(bus_req),
+		.t_we(bus_we),
+		.t_addr(bus_addr),
+		.t_wdata(bus_wdata),
+		.t_wmask(bus_wmask),
+		.t_rdata(bus_rdata),
+		.t_ack(bus_ack)
+	);
+
+	wire [29:0] t_addr;
+	wire        t_we;
+	wire [15:0] t_wdata;
+	wire [1:0]  t_wmask;
+
+	wire        rom_req, rom_ack, sram_req, sram_ack, sdram_req, io_req;
+	wire [15:0] rom_rdata, sram_rdata;
+	reg         io_ack = 0;
+	reg  [15:0] io_rdata;
+
+	bus_decoder decoder (
+		.mem_layout(mem_layout),
+		.req(bus_req),
+		.we(bus_we),
+		.addr(bus_addr),
+		.wdata(bus_wdata),
+		.wmask(bus_wmask),
+		.rdata(bus_rdata),
+		.ack(bus_ack),
+		.t_addr(t_addr),
+		.t_we(t_we),
+		.t_wdata(t_wdata),
+		.t_wmask(t_wmask),
+		.rom_req(rom_req),
+		.rom_rdata(rom_rdata),
+		.rom_ack(rom_ack),
+		.sram_req(sram_req),
+		.sram_rdata(sram_rdata),
+		.sram_ack(sram_ack),
+		// no sdram controller yet, it reads as zero
+		.sdram_req(sdram_req),
+		.sdram_rdata(16'b0),
+		.sdram_ack(sdram_req),
+		.io_req(io_req),
+		.io_rdata(io_rdata),
+		.io_ack(io_ack)
+	);
+
+	// 64 KiB each
+	bus_bram #(.ADDR_BITS(15), .WRITABLE(0), .INIT(ROM_INIT)) rom (
+		.clk(bufg_clk),
+		.req(rom_req),
+		.we(t_we),
+		.addr(t_addr[14:0]),
+		.wdata(t_wdata),
+		.wmask(t_wmask),
+		.rdata(rom_rdata),
+		.ack(rom_ack)
+	);
+
+	bus_bram #(.ADDR_BITS(15)) sram (
+		.clk(bufg_clk),
+		.req(sram_req),
+		.we(t_we),
+		.addr(t_addr[14:0]),
+		.wdata(t_wdata),
+		.wmask(t_wmask),
+		.rdata(sram_rdata),
+		.ack(sram_ack)
+	);
+
+	// the top quadrant only has the 7-segment display (0xc000_0000, 32 bits) for now
+	reg [31:0] display = 0;
+
+	always @(posedge bufg_clk) begin
+		io_ack <= io_req && !io_ack;
+		if (io_req && !io_ack) begin
+			if (t_we && t_addr[0] == 1'b0) begin
+				if (t_wmask[0]) display[7:0]   <= t_wdata[7:0];
+				if (t_wmask[1]) display[15:8]  <= t_wdata[15:8];
+			end
+			if (t_we && t_addr[0] == 1'b1) begin
+				if (t_wmask[0]) display[23:16] <= t_wdata[7:0];
+				if (t_wmask[1]) display[31:24] <= t_wdata[15:8];
+			end
+			io_rdata <= t_addr[0] ? display[31:16] : display[15:0];
+		end
+	end
 
 	segment_displayer s7(
 		.clk(bufg_clk),
-		.value(counter >> LOG2DELAY),
+		.value(display),
 		.cathodes(cathodes),
 		.anodes(anodes)
 	);
@@ -11,12 +11,16 @@ pub enum AluOp {
     Sr   = 0b0011,
     Lsl  = 0b0100,
     Lsr  = 0b0101,
+    Mul  = 0b0110,
+    Mulh = 0b0111,
     Or   = 0b1000,
     Eor  = 0b1001,
     And  = 0b1010,
+    Div  = 0b1011,
     Nor  = 0b1100,
     Enor = 0b1101,
-    Nand = 0b1110
+    Nand = 0b1110,
+    Mod  = 0b1111
 }
 
 #[derive(FromPrimitive, Debug, PartialEq)]
@@ -146,12 +150,16 @@ impl std::fmt::Display for Insn {
                     AluOp::Sr => write!(f, "sr")?,
                     AluOp::Lsl => write!(f, "lsl")?,
                     AluOp::Lsr => write!(f, "lsr")?,
+                    AluOp::Mul => write!(f, "mul")?,
+                    AluOp::Mulh => write!(f, "mulh")?,
                     AluOp::Or => write!(f, "or")?,
                     AluOp::Eor => write!(f, "eor")?,
                     AluOp::And => write!(f, "and")?,
                     AluOp::Nor => write!(f, "nor")?,
                     AluOp::Enor => write!(f, "enor")?,
-                    AluOp::Nand => write!(f, "nand")?
+                    AluOp::Nand => write!(f, "nand")?,
+                    AluOp::Div => write!(f, "div")?,
+                    AluOp::Mod => write!(f, "mod")?
                 };
                 match (&self.content, style) {
                     (InsnContent::Short {rd, ro}, AluSty::Reg) => write!(f, " r{0}, r{0}, r{1}", rd, ro),
@@ -21,16 +21,16 @@ fn disas(raw_data: Vec<u8>) {
         let start_addr: u32 = 
             (raw_data[ptr] as u32) |
             ((raw_data[ptr + 1] as u32) << 8) |
-            ((raw_data[ptr + 2] as u32) << 8) |
-            ((raw_data[ptr + 3] as u32) << 8);
+            ((raw_data[ptr + 2] as u32) << 16) |
+            ((raw_data[ptr + 3] as u32) << 24);
 
         ptr += 4;
 
         let section_length: usize = 
             (raw_data[ptr] as usize) |
             ((raw_data[ptr + 1] as usize) << 8) |
-            ((raw_data[ptr + 2] as usize) << 8) |
-            ((raw_data[ptr + 3] as usize) << 8);
+            ((raw_data[ptr + 2] as usize) << 16) |
+            ((raw_data[ptr + 3] as usize) << 24);
 
         ptr += 4;
 
@@ -0,0 +1,462 @@
+#include "disas.h"
+#include "imgfmt.h"
+#include "insns.h"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+namespace mdis {
+	using namespace masm::insn;
+
+	namespace {
+		enum class kind : uint8_t {
+			INVALID,
+			LOAD,
+			STORE,
+			ALU,
+			MOV,
+			JUMP
+		};
+
+		// Everything about an opcode that doesn't depend on the rest of the instruction
+		struct entry {
+			kind k = kind::INVALID;
+			uint8_t name_len = 0;
+			char name[8]{};
+			format::e fmt[2]{}; // short, long
+		};
+
+		std::array<entry, 128> build_table() {
+			static const char *ls_dests[] = {"", ".s", ".l", ".h"};
+			static const char *mov_conds[] = {".lt", ".slt", ".ge", ".sge", ".eq", ".ne", ".bs", ""};
+			static const char *alu_ops[] = {
+				"add", "sub", "sl", "sr", "lsl", "lsr", "mul", "mulh",
+				"or", "eor", "and", "div", "nor", "enor", "nand", "mod"
+			};
+
+			std::array<entry, 128> table{};
+			for (uint32_t opcode = 0; opcode < 128; ++opcode) {
+				entry& e = table[opcode];
+				std::string name;
+
+				switch (opcode >> 5) {
+					case 0b00:
+						{
+							bool store = (opcode >> 4) & 1;
+							uint32_t dest = (opcode >> 1) & 0b11;
+							if (store && !(dest & load_store_dest::LOWW)) continue;
+
+							name = store ? "st" : "ld";
+							if (((opcode >> 3) & 1) == load_store_size::BYTE) name += ".b";
+							name += ls_dests[dest];
+							e.k = store ? kind::STORE : kind::LOAD;
+						}
+						break;
+					case 0b01:
+						name = (opcode & 0b11) == mov_op::JUMP ? "jmp" : "mov";
+						name += mov_conds[(opcode >> 2) & 0b111];
+						e.k = (opcode & 0b11) == mov_op::JUMP ? kind::JUMP : kind::MOV;
+						break;
+					default:
+						if (!alu_ops[(opcode >> 2) & 0b1111]) continue;
+						name = alu_ops[(opcode >> 2) & 0b1111];
+						e.k = kind::ALU;
+						break;
+				}
+
+				std::copy(name.begin(), name.end(), e.name);
+				e.name_len = name.size();
+				e.fmt[0] = format_for(opcode, false);
+				e.fmt[1] = format_for(opcode, true);
+			}
+			return table;
+		}
+
+		const std::array<entry, 128> table = build_table();
+
+		// Longest text format_insn writes, apart from symbol names
+		constexpr size_t max_insn_text = 96;
+
+		// Writes into a buffer the caller has made big enough, without going through any
+		// formatting machinery
+		struct text {
+			char *p;
+
+			void put(char c) {
+				*p++ = c;
+			}
+
+			void put(std::string_view s) {
+				memcpy(p, s.data(), s.size());
+				p += s.size();
+			}
+
+			// at least digits hex digits, no prefix
+			void hex(uint32_t v, int digits) {
+				char buf[8];
+				int n = 0;
+				do {
+					buf[n++] = "0123456789abcdef"[v & 0xf];
+					v >>= 4;
+				} while (v || n < digits);
+				while (n) put(buf[--n]);
+			}
+
+			void reg(uint32_t r) {
+				if (r == 15) {
+					put("pc");
+					return;
+				}
+				put('r');
+				if (r >= 10) {
+					put('1');
+					r -= 10;
+				}
+				put((char)('0' + r));
+			}
+
+			// small values in decimal, everything else in hex; negative values are bracketed like
+			// mcasm wants them
+			void num(int64_t v) {
+				if (v < 0) {
+					put("(-");
+					num(-v);
+					put(')');
+				}
+				else if (v < 10) put((char)('0' + v));
+				else {
+					put("0x");
+					hex((uint32_t)v, 1);
+				}
+			}
+
+			void hex8(uint32_t v) {
+				for (int i = 7; i >= 0; --i, v >>= 4) p[i] = "0123456789abcdef"[v & 0xf];
+				p += 8;
+			}
+
+			void address(uint32_t v) {
+				put("0x");
+				hex8(v);
+			}
+		};
+
+		void put_data(text& t, const uint8_t *data, size_t length) {
+			if (length == 1) {
+				t.put(".db 0x");
+				t.hex(data[0], 2);
+			}
+			else {
+				t.put(".dw 0x");
+				t.hex(data[0] | (data[1] << 8), 4);
+			}
+		}
+	}
+
+	void symbols::load(const std::string& path) {
+		std::ifstream f(path);
+		if (!f) throw std::runtime_error("unable to open symbol file " + path);
+
+		std::string line;
+		size_t lineno = 0;
+		while (std::getline(f, line)) {
+			++lineno;
+			size_t start = line.find_first_not_of(" \t");
+			if (start == std::string::npos || line[start] == '#') continue;
+
+			char *end;
+			unsigned long address = strtoul(line.c_str() + start, &end, 16);
+			size_t name_start = line.find_first_not_of(" \t", end - line.c_str());
+			if (end == line.c_str() + start || name_start == std::string::npos || name_start == (size_t)(end - line.c_str()))
+				throw std::runtime_error(path + ":" + std::to_string(lineno) + ": expected an address and a name");
+
+			size_t name_end = line.find_last_not_of(" \t\r");
+			table.emplace_back((uint32_t)address, line.substr(name_start, name_end + 1 - name_start));
+			longest_name = std::max(longest_name, table.back().second.size());
+		}
+
+		std::stable_sort(table.begin(), table.end(), [](const auto& x, const auto& y){return x.first < y.first;});
+	}
+
+	void symbols::add(uint32_t address, std::string name) {
+		auto it = std::upper_bound(table.begin(), table.end(), address, [](uint32_t a, const auto& s){return a < s.first;});
+		longest_name = std::max(longest_name, name.size());
+		table.emplace(it, address, std::move(name));
+	}
+
+	const std::string *symbols::at(uint32_t address) const {
+		auto it = std::lower_bound(table.begin(), table.end(), address, [](const auto& s, uint32_t a){return s.first < a;});
+		if (it == table.end() || it->first != address) return nullptr;
+		return &it->second;
+	}
+
+	size_t format_insn(const uint8_t *data, size_t length, uint32_t address, text& t, const symbols *syms) {
+		if (length == 0) return 0;
+		if (length < 2) {
+			put_data(t, data, length);
+			return length;
+		}
+
+		uint32_t raw = data[0] | (data[1] << 8);
+		bool is_long = is_long_halfword(raw);
+		const entry& e = table[raw & 0x7f];
+		if (e.k == kind::INVALID || (is_long && length < 4)) {
+			// resynchronise on the next halfword
+			put_data(t, data, 2);
+			return 2;
+		}
+		if (is_long) raw |= (data[2] << 16) | ((uint32_t)data[3] << 24);
+
+		decoded d = decode(raw, e.fmt[is_long]);
+
+		t.put(std::string_view{e.name, e.name_len});
+		t.put(' ');
+
+		// statically known branch target or data address, for annotating
+		std::optional<uint32_t> target;
+		bool is_relative = false;
+
+		switch (e.k) {
+			case kind::LOAD:
+			case kind::STORE:
+				t.reg(d.rd);
+				t.put(", [");
+				switch (d.fmt) {
+					case format::F:
+						{
+							uint32_t addr = (d.FF << 30) | ((uint32_t)d.imm & 0x3fff'ffff);
+							t.address(addr);
+							if (d.ro) {
+								t.put(" + ");
+								t.reg(d.ro);
+							}
+							else target = addr;
+						}
+						break;
+					case format::T:
+						t.reg(d.ro);
+						if (d.imm) {
+							t.put(" + ");
+							t.num(d.imm);
+						}
+						if (d.rs) {
+							t.put(" + ");
+							t.reg(d.rs);
+							if (d.FF) {
+								t.put(" << ");
+								t.put((char)('0' + d.FF));
+							}
+						}
+						if (d.ro == 15 && !d.rs) target = address + d.imm;
+						break;
+					default:
+						t.reg(d.ro);
+						break;
+				}
+				t.put(']');
+				break;
+
+			case kind::ALU:
+				t.reg(d.rd);
+				t.put(", ");
+				switch (d.fmt) {
+					case format::A:
+						t.reg(d.rs);
+						t.put(", ");
+						t.num(d.imm);
+						break;
+					case format::M:
+						t.reg(d.ro);
+						t.put(", ");
+						t.num(d.imm);
+						break;
+					case format::T:
+						t.reg(d.rs);
+						t.put(", ");
+						t.reg(d.ro);
+						t.put((d.opcode & 0b11) == alu_sty::REGSL ? " << " : " >> ");
+						t.put((char)('1' + d.FF));
+						break;
+					default:
+						t.reg(d.rs);
+						t.put(", ");
+						t.reg(d.ro);
+						break;
+				}
+				if ((d.opcode & 0b11) == alu_sty::IMM && d.rd == 15 && (d.fmt == format::A ? d.rs : d.ro) == 15 &&
+					((d.opcode >> 2) & 0b1111) == alu_op::ADD) {
+					target = address + d.imm;
+					is_relative = true;
+				}
+				break;
+
+			case kind::MOV:
+			case kind::JUMP:
+				{
+					uint32_t op = d.opcode & 0b11;
+					uint32_t cond = (d.opcode >> 2) & 0b111;
+
+					// what gets written / jumped to
+					if (op == mov_op::MIMM) {
+						t.reg(d.rd);
+						t.put(", ");
+						t.num(d.imm);
+						if (d.rd == 15) target = d.imm;
+					}
+					else {
+						uint32_t src = op == mov_op::JUMP ? d.rd : op == mov_op::MRS ? d.rs : d.ro;
+						if (op != mov_op::JUMP) {
+							t.reg(d.rd);
+							t.put(", ");
+						}
+						t.reg(src);
+						if (d.FF == 0b11) {
+							t.put(" + ");
+							t.num(d.imm);
+						}
+						if ((op == mov_op::JUMP || d.rd == 15) && src == 15) {
+							target = address + (d.FF == 0b11 ? d.imm : 0);
+							is_relative = true;
+						}
+					}
+
+					// the operands that are compared
+					if (cond != mov_cond::AL) {
+						t.put(", ");
+						if (op != mov_op::MIMM && d.FF == 0b01) t.num(d.imm);
+						else t.reg(d.rs);
+						t.put(", ");
+						if (op != mov_op::MIMM && d.FF == 0b10) t.num(d.imm);
+						else t.reg(d.ro);
+					}
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		if (target) {
+			const std::string *name = syms ? syms->at(*target) : nullptr;
+			if (name) {
+				t.put("  // ");
+				t.put(*name);
+			}
+			else if (is_relative) {
+				t.put("  // ");
+				t.address(*target);
+			}
+		}
+
+		return d.length();
+	}
+
+	size_t disassemble_insn(const uint8_t *data, size_t length, uint32_t address, std::string& out, const symbols *syms) {
+		size_t used = out.size();
+		out.resize(used + max_insn_text + (syms ? syms->longest() : 0));
+		text t{out.data() + used};
+		size_t n = format_insn(data, length, address, t, syms);
+		out.resize(t.p - out.data());
+		return n;
+	}
+
+	void disassemble_image(const uint8_t *data, size_t length, const options& opts, const std::function<void(std::string_view)>& sink) {
+		static constexpr size_t flush_at = 1 << 20;
+
+		const symbols *syms = opts.syms && !opts.syms->empty() ? opts.syms : nullptr;
+
+		// room for one more line (with a label before it) past the flush point
+		size_t longest = syms ? syms->longest() : 0;
+		std::vector<char> out(flush_at + 2 * (longest + max_insn_text));
+		text t{out.data()};
+
+		auto flush = [&]{
+			sink(std::string_view{out.data(), (size_t)(t.p - out.data())});
+			t.p = out.data();
+		};
+
+		auto get = [&](size_t at){
+			return (uint32_t)data[at] | ((uint32_t)data[at + 1] << 8) | ((uint32_t)data[at + 2] << 16) | ((uint32_t)data[at + 3] << 24);
+		};
+
+		auto section_at = [&](uint32_t base, const uint8_t *section, uint32_t len) {
+			t.put("\nsection at ");
+			t.address(base);
+			t.put("; length ");
+			t.address(len);
+			t.put("\n\n");
+
+			// symbols are walked alongside the instructions instead of looked up for each one
+			auto sym = syms ? std::lower_bound(syms->sorted().begin(), syms->sorted().end(), base, [](const auto& s, uint32_t a){return s.first < a;}) : std::vector<std::pair<uint32_t, std::string>>::const_iterator{};
+
+			size_t off = 0;
+			while (off < len) {
+				uint32_t address = base + off;
+
+				if (syms) {
+					while (sym != syms->sorted().end() && sym->first < address) ++sym;
+					for (; sym != syms->sorted().end() && sym->first == address; ++sym) {
+						t.put(sym->second);
+						t.put(":\n");
+						if (t.p - out.data() >= (ptrdiff_t)flush_at) flush();
+					}
+				}
+
+				t.hex8(address);
+				t.put(": ");
+
+				// leave room for the raw halfwords, which are known once the length is
+				char *raw_at = t.p;
+				if (opts.raw) t.put("           ");
+
+				size_t n = format_insn(section + off, len - off, address, t, syms);
+
+				if (opts.raw) {
+					static constexpr char digits[] = "0123456789abcdef";
+					for (size_t b = 0; b < n; ++b) {
+						// halfwords are printed as numbers, so high byte first
+						char *pos = n == 1 ? raw_at : raw_at + (b / 2) * 5 + (b & 1 ? 0 : 2);
+						pos[0] = digits[section[off + b] >> 4];
+						pos[1] = digits[section[off + b] & 0xf];
+					}
+				}
+				t.put('\n');
+
+				off += n;
+				if (t.p - out.data() >= (ptrdiff_t)flush_at) flush();
+			}
+		};
+
+		namespace fmt = masm::imgfmt;
+		if (length >= sizeof fmt::paged_magic && !memcmp(data, fmt::paged_magic, sizeof fmt::paged_magic)) {
+			if (length < fmt::paged_header_size) throw std::runtime_error("truncated header in paged image");
+			size_t count = get(0x10);
+			if ((length - fmt::paged_header_size) / fmt::paged_entry_size < count) throw std::runtime_error("truncated section index in paged image");
+			for (size_t i = 0; i < count; ++i) {
+				size_t e = fmt::paged_header_size + i * fmt::paged_entry_size;
+				uint32_t len = get(e + 4);
+				uint64_t offset = get(e + 8) | (uint64_t)get(e + 12) << 32;
+				if (offset > length || length - offset < len) throw std::runtime_error("truncated section contents in paged image");
+				section_at(get(e), data + offset, len);
+			}
+		}
+		else {
+			size_t ptr = 0;
+			while (ptr < length) {
+				if (length - ptr < 8) throw std::runtime_error("truncated section header in image");
+				uint32_t base = get(ptr);
+				uint32_t len = get(ptr + 4);
+				ptr += 8;
+				if (length - ptr < len) throw std::runtime_error("truncated section contents in image");
+				section_at(base, data + ptr, len);
+				ptr += len;
+			}
+		}
+
+		if (t.p != out.data()) flush();
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mdis {
+	// Names for addresses, used to label the output and branch targets.
+	//
+	// Symbol files have one "ADDRESS NAME" pair per line with the address in hex (0x optional);
+	// empty lines and lines starting with # are skipped.
+	struct symbols {
+		// Throws std::runtime_error if the file can't be read or a line is malformed
+		void load(const std::string& path);
+		void add(uint32_t address, std::string name);
+
+		// Name of the (first) symbol at exactly address, or nullptr
+		const std::string *at(uint32_t address) const;
+
+		// All symbols, in address order
+		const std::vector<std::pair<uint32_t, std::string>>& sorted() const {
+			return table;
+		}
+
+		bool empty() const {
+			return table.empty();
+		}
+
+		size_t longest() const {
+			return longest_name;
+		}
+
+	private:
+		std::vector<std::pair<uint32_t, std::string>> table;
+		size_t longest_name = 0;
+	};
+
+	struct options {
+		const symbols *syms = nullptr;
+		// show the encoded halfwords next to each instruction
+		bool raw = true;
+	};
+
+	// Append the text for the instruction at data (no address, no newline) to out. Returns how
+	// many bytes it took; anything that doesn't decode (or is cut off by the end of the data) is
+	// written out as data instead.
+	size_t disassemble_insn(const uint8_t *data, size_t length, uint32_t address, std::string& out, const symbols *syms = nullptr);
+
+	// Disassemble a whole mcasm image, stream or paged (see imgfmt.h). Text is handed to sink in
+	// large chunks as it is produced, so the image can be arbitrarily large. Throws
+	// std::runtime_error if the image is truncated.
+	void disassemble_image(const uint8_t *data, size_t length, const options& opts, const std::function<void(std::string_view)>& sink);
+}
@@ -0,0 +1,106 @@
+// Disassembler for mcasm images.
+//
+// The image is mapped rather than read, and the text is written out in large chunks, so even
+// multi-megabyte memory dumps go through about as fast as the output can be written.
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "disas.h"
+
+namespace {
+	void usage() {
+		fprintf(stderr, "usage: mcdis [--symbols FILE] [--no-raw] IMAGE\n");
+	}
+
+	// Read-only mapping of a whole file
+	struct mapped_file {
+		const uint8_t *data = nullptr;
+		size_t length = 0;
+
+		explicit mapped_file(const char *path) {
+			int fd = open(path, O_RDONLY);
+			if (fd < 0) throw std::runtime_error(std::string("unable to open image ") + path + ": " + strerror(errno));
+
+			struct stat st;
+			if (fstat(fd, &st) < 0) {
+				close(fd);
+				throw std::runtime_error(std::string("unable to stat image ") + path + ": " + strerror(errno));
+			}
+			length = st.st_size;
+
+			if (length) {
+				void *m = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (m == MAP_FAILED) {
+					close(fd);
+					throw std::runtime_error(std::string("unable to map image ") + path + ": " + strerror(errno));
+				}
+				madvise(m, length, MADV_SEQUENTIAL);
+				data = (const uint8_t *)m;
+			}
+			close(fd);
+		}
+
+		~mapped_file() {
+			if (data) munmap((void *)data, length);
+		}
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+	};
+}
+
+int main(int argc, char ** argv) {
+	std::string image, symbol_file;
+	mdis::options opts;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if (arg == "--symbols" || arg == "-s") {
+			if (i + 1 >= argc) {
+				usage();
+				return 2;
+			}
+			symbol_file = argv[++i];
+		}
+		else if (arg == "--no-raw") opts.raw = false;
+		else if (image.empty() && arg[0] != '-') image = arg;
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (image.empty()) {
+		usage();
+		return 2;
+	}
+
+	try {
+		mdis::symbols syms;
+		if (!symbol_file.empty()) {
+			syms.load(symbol_file);
+			opts.syms = &syms;
+		}
+
+		mapped_file f(image.c_str());
+		mdis::disassemble_image(f.data, f.length, opts, [](std::string_view chunk){
+			fwrite(chunk.data(), 1, chunk.size(), stdout);
+		});
+	}
+	catch (const std::exception& e) {
+		fflush(stdout);
+		fprintf(stderr, "mcdis: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -8,11 +8,12 @@
 
 #define TimerCounter (MEM_SEC2_BASE + 0)
 
-.org 0
+.irqtable 0
+.irq 0
 	jmp ResetEntry
 
-.org IRQ_HANDLE_OFF(IRQn_TIMER)
-	// inline
+.irq IRQn_TIMER
+	// fits in the slot, so no jump
 	ld r1, [TimerCounter]
 	add r1, r1, 1
 	st.l r0, [TimerCounter]
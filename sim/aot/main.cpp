@@ -0,0 +1,536 @@
+// Ahead-of-time translation of an mcasm image to C.
+//
+// Code is found by following control flow from the entry points (address 0 and any --entry),
+// along with the pc-relative addresses code computes (return addresses from call, rel moves).
+// Every basic block becomes a C function that keeps the registers it uses in locals, and a
+// lookup switch maps addresses to blocks. What can't be translated (jumps to code that wasn't
+// found, cpu register accesses, running after MEM_LAYOUT changed) is left to the reference model
+// in the runtime (see mcpu_aot.h), so the result runs like the model does, just natively.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "disas.h"
+#include "image.h"
+#include "insns.h"
+#include "memory.h"
+
+namespace {
+	using namespace masm::insn;
+
+	struct options {
+		std::string image, output;
+		std::vector<uint32_t> entries{0};
+	};
+
+	void usage() {
+		fputs(
+			"usage: mcpu-aot [options] image.bin output.c\n"
+			"  --entry ADDR        also translate code reached from ADDR (e.g. interrupt handlers)\n",
+			stderr
+		);
+	}
+
+	std::string hex(uint32_t value) {
+		char buf[16];
+		snprintf(buf, sizeof buf, "0x%08xu", value);
+		return buf;
+	}
+
+	std::string block_name(uint32_t addr) {
+		char buf[16];
+		snprintf(buf, sizeof buf, "b_%08x", addr);
+		return buf;
+	}
+
+	struct instruction {
+		uint32_t raw;
+		decoded d;
+	};
+
+	// What an instruction does to control flow, as far as can be told statically
+	struct flow {
+		bool writes_pc = false;
+		bool conditional = false;
+		std::optional<uint32_t> target;
+		// a pc-relative value written to another register, e.g. a return address
+		std::optional<uint32_t> code_ref;
+		// accesses the cpu register block
+		bool cpureg = false;
+	};
+
+	// r0 and pc are the only registers known without running anything
+	std::optional<uint32_t> known(uint32_t reg, uint32_t pc) {
+		if (reg == 0) return 0;
+		if (reg == 15) return pc;
+		return std::nullopt;
+	}
+
+	flow analyse(uint32_t pc, const decoded& d) {
+		flow f;
+		switch (d.opcode >> 5) {
+			case 0b00:
+				{
+					std::optional<uint32_t> addr;
+					switch (d.fmt) {
+						case format::T:
+							if (auto o = known(d.ro, pc), s = known(d.rs, pc); o && s) addr = d.imm + *o + (*s << d.FF);
+							break;
+						case format::F:
+							if (auto o = known(d.ro, pc)) addr = ((d.FF << 30) | ((uint32_t)d.imm & 0x3fff'ffff)) + *o;
+							break;
+						default:
+							addr = known(d.ro, pc);
+							break;
+					}
+					f.cpureg = addr && msim::target_for(*addr, msim::reset_mem_layout) == msim::target::CPUREGS;
+					f.writes_pc = ((d.opcode >> 4) & 1) == load_store_kind::LOAD && d.rd == 15;
+				}
+				break;
+			case 0b01:
+				{
+					uint32_t cond = (d.opcode >> 2) & 0b111;
+					uint32_t op = d.opcode & 0b11;
+					if (op != mov_op::JUMP && d.rd == 0) break;
+
+					std::optional<uint32_t> value;
+					bool from_pc = false;
+					switch (op) {
+						case mov_op::MIMM: value = d.imm; break;
+						case mov_op::JUMP: value = known(d.rd, pc); from_pc = d.rd == 15; break;
+						case mov_op::MRS:  value = known(d.rs, pc); from_pc = d.rs == 15; break;
+						case mov_op::MRO:  value = known(d.ro, pc); from_pc = d.ro == 15; break;
+					}
+					if (value && d.FF == 0b11) *value += d.imm;
+
+					if (op == mov_op::JUMP || d.rd == 15) {
+						f.writes_pc = true;
+						f.conditional = cond != mov_cond::AL;
+						f.target = value;
+					}
+					else if (from_pc) f.code_ref = value;
+				}
+				break;
+			default:
+				{
+					if (d.rd == 0) break;
+
+					// only add/sub of pc and an immediate (which is how call makes its return address)
+					std::optional<uint32_t> value;
+					uint32_t op = (d.opcode >> 2) & 0b1111;
+					bool from_pc = false;
+					if ((d.opcode & 0b11) == alu_sty::IMM && (op == alu_op::ADD || op == alu_op::SUB)) {
+						uint32_t a = d.fmt == format::A ? d.rs : d.ro;
+						if (auto v = known(a, pc)) value = op == alu_op::ADD ? *v + d.imm : *v - d.imm;
+						from_pc = a == 15;
+					}
+
+					if (d.rd == 15) {
+						f.writes_pc = true;
+						f.target = value;
+					}
+					else if (from_pc) f.code_ref = value;
+				}
+				break;
+		}
+		return f;
+	}
+
+	struct program {
+		std::vector<msim::image_section> sections;
+		std::map<uint32_t, instruction> code;
+		std::set<uint32_t> leaders;
+
+		// The instruction at addr, if all of it is in the image
+		std::optional<instruction> fetch(uint32_t addr) const {
+			for (const auto& s : sections) {
+				if (addr < s.base_address || addr - s.base_address + 2 > s.data.size() || (addr & 1)) continue;
+				size_t at = addr - s.base_address;
+				uint32_t raw = s.data[at] | (s.data[at + 1] << 8);
+				if (is_long_halfword(raw)) {
+					if (at + 4 > s.data.size()) return std::nullopt;
+					raw |= (uint32_t)(s.data[at + 2] | (s.data[at + 3] << 8)) << 16;
+				}
+				return instruction{raw, decode(raw)};
+			}
+			return std::nullopt;
+		}
+
+		// Follow control flow from the entry points, marking where blocks start
+		void discover(const std::vector<uint32_t>& entries) {
+			std::vector<uint32_t> pending;
+			auto lead = [&](uint32_t addr) {
+				if (fetch(addr) && leaders.insert(addr).second) pending.push_back(addr);
+			};
+			for (uint32_t e : entries) lead(e);
+
+			while (!pending.empty()) {
+				uint32_t pc = pending.back();
+				pending.pop_back();
+
+				// anything already decoded had its successors found then
+				while (!code.count(pc)) {
+					auto i = fetch(pc);
+					if (!i) break;
+					code.emplace(pc, *i);
+
+					auto f = analyse(pc, i->d);
+					uint32_t next = pc + i->d.length();
+					if (f.code_ref) lead(*f.code_ref);
+					if (f.target) lead(*f.target);
+					if (f.cpureg || (f.writes_pc && f.conditional)) lead(next);
+					if (f.cpureg || (f.writes_pc && !f.conditional)) break;
+
+					// joining code found earlier makes that a block of its own
+					if (code.count(next)) lead(next);
+					pc = next;
+				}
+			}
+		}
+	};
+
+	// Writes the C for one block
+	struct block_writer {
+		const program& prog;
+		uint32_t start;
+
+		std::string body;
+		std::set<uint32_t> used, written;
+		bool exits = false, loops = false, memory = false, loads = false;
+
+		// retired before the instruction being written
+		uint32_t count = 0;
+
+		block_writer(const program& prog, uint32_t start) : prog(prog), start(start) {}
+
+		std::string reg(uint32_t r, uint32_t pc) {
+			if (r == 0) return "0u";
+			if (r == 15) return hex(pc);
+			used.insert(r);
+			return "r" + std::to_string(r);
+		}
+
+		void line(const std::string& text, int indent = 1) {
+			body.append(indent, '\t');
+			body += text;
+			body += '\n';
+		}
+
+		// leave the block after retiring n instructions, taken of them jumps
+		void exit(const std::string& next, uint32_t n, bool taken, int indent = 1) {
+			line("next = " + next + "; n = " + std::to_string(n) + "; taken = " + (taken ? "1" : "0") + ";", indent);
+			line("goto out;", indent);
+			exits = true;
+		}
+
+		// leave the block with pc written by the current instruction
+		void jump(uint32_t pc, const std::optional<uint32_t>& target, const std::string& value, int indent) {
+			if (target && *target == pc) {
+				line("mcpu_aot_halt(m);", indent);
+				exit(hex(pc), count + 1, true, indent);
+			}
+			else if (target && *target == start) {
+				// loop within the block, as long as the run has instructions left
+				line("if (!mcpu_aot_retire(m, " + std::to_string(count + 1) + ", 1)) goto top;", indent);
+				line("next = " + hex(start) + ";", indent);
+				line("goto spill;", indent);
+				loops = true;
+			}
+			else exit(target ? hex(*target) : value, count + 1, true, indent);
+		}
+
+		// rd = value (if cond), which may be a jump
+		void write(uint32_t pc, uint32_t rd, const std::string& cond, const std::string& value, const flow& f) {
+			if (rd == 0 && !f.writes_pc) return;
+			if (f.writes_pc) {
+				if (cond.empty()) jump(pc, f.target, value, 1);
+				else {
+					line("if (" + cond + ") {");
+					jump(pc, f.target, value, 2);
+					line("}");
+				}
+				return;
+			}
+			written.insert(rd);
+			std::string assign = reg(rd, pc) + " = " + value + ";";
+			line(cond.empty() ? assign : "if (" + cond + ") " + assign);
+		}
+
+		void load_store(uint32_t pc, const decoded& d, const flow& f) {
+			uint32_t kind = (d.opcode >> 4) & 1;
+			uint32_t size = (d.opcode >> 3) & 1;
+			uint32_t dest = (d.opcode >> 1) & 0b11;
+
+			std::string addr;
+			switch (d.fmt) {
+				case format::T:
+					addr = hex(d.imm) + " + " + reg(d.ro, pc) + " + (" + reg(d.rs, pc) + " << " + std::to_string(d.FF) + ")";
+					break;
+				case format::F:
+					addr = hex((d.FF << 30) | ((uint32_t)d.imm & 0x3fff'ffff)) + " + " + reg(d.ro, pc);
+					break;
+				default:
+					addr = reg(d.ro, pc);
+					break;
+			}
+			// the model does the cpu registers (for task switches, counters and so on)
+			if (f.cpureg) {
+				line("mcpu_aot_step(m);");
+				exit(hex(pc), count, false);
+				return;
+			}
+			memory = true;
+			line("a = " + addr + ";");
+			line("if ((a >> 30) == 2) {");
+			line("mcpu_aot_step(m);", 2);
+			exit(hex(pc), count, false, 2);
+			line("}");
+
+			if (kind == load_store_kind::STORE) {
+				std::string data = dest == load_store_dest::HIGHW ? "(" + reg(d.rd, pc) + " >> 16)" : "(" + reg(d.rd, pc) + " & 0xffffu)";
+				if (size == load_store_size::BYTE) line("mcpu_aot_write(m, a, (uint16_t)((" + data + " & 0xffu) << ((a & 1) * 8)), 1 << (a & 1));");
+				else line("mcpu_aot_write(m, a, (uint16_t)" + data + ", 3);");
+				return;
+			}
+
+			loads = true;
+			line("v = mcpu_aot_read(m, a);");
+			if (size == load_store_size::BYTE) line("v = (v >> ((a & 1) * 8)) & 0xffu;");
+			std::string value;
+			switch (dest) {
+				case load_store_dest::ZEXT:
+					value = "v";
+					break;
+				case load_store_dest::SEXT:
+					value = size == load_store_size::BYTE ? "(uint32_t)(int32_t)(int8_t)v" : "(uint32_t)(int32_t)(int16_t)v";
+					break;
+				case load_store_dest::LOWW:
+					value = "(" + reg(d.rd, pc) + " & 0xffff0000u) | v";
+					break;
+				default:
+					value = "(" + reg(d.rd, pc) + " & 0xffffu) | (v << 16)";
+					break;
+			}
+			write(pc, d.rd, "", value, f);
+		}
+
+		void mov(uint32_t pc, const decoded& d, const flow& f) {
+			uint32_t cond = (d.opcode >> 2) & 0b111;
+			uint32_t op = d.opcode & 0b11;
+
+			std::string result;
+			switch (op) {
+				case mov_op::MIMM: result = hex(d.imm); break;
+				case mov_op::JUMP: result = reg(d.rd, pc); break;
+				case mov_op::MRS:  result = reg(d.rs, pc); break;
+				case mov_op::MRO:  result = reg(d.ro, pc); break;
+			}
+			if (d.FF == 0b11) result += " + " + hex(d.imm);
+
+			std::string test;
+			if (cond != mov_cond::AL) {
+				std::string op1 = d.FF == 0b01 ? hex(d.imm) : reg(d.rs, pc);
+				std::string op2 = d.FF == 0b10 ? hex(d.imm) : reg(d.ro, pc);
+				switch (cond) {
+					case mov_cond::LT:  test = op1 + " < " + op2; break;
+					case mov_cond::SLT: test = "(int32_t)" + op1 + " < (int32_t)" + op2; break;
+					case mov_cond::GE:  test = op1 + " >= " + op2; break;
+					case mov_cond::SGE: test = "(int32_t)" + op1 + " >= (int32_t)" + op2; break;
+					case mov_cond::EQ:  test = op1 + " == " + op2; break;
+					case mov_cond::NEQ: test = op1 + " != " + op2; break;
+					default:            test = "(" + op1 + " & " + op2 + ") != 0"; break;
+				}
+			}
+			write(pc, op == mov_op::JUMP ? 15 : d.rd, test, result, f);
+		}
+
+		void alu(uint32_t pc, const decoded& d, const flow& f) {
+			std::string a, b;
+			switch (d.opcode & 0b11) {
+				case alu_sty::REG:
+					a = reg(d.rs, pc);
+					b = reg(d.ro, pc);
+					break;
+				case alu_sty::IMM:
+					a = reg(d.fmt == format::A ? d.rs : d.ro, pc);
+					b = hex(d.imm);
+					break;
+				case alu_sty::REGSL:
+					a = reg(d.rs, pc);
+					b = "(" + reg(d.ro, pc) + " << " + std::to_string(d.FF + 1) + ")";
+					break;
+				default:
+					a = reg(d.rs, pc);
+					b = "(" + reg(d.ro, pc) + " >> " + std::to_string(d.FF + 1) + ")";
+					break;
+			}
+
+			std::string value;
+			switch ((d.opcode >> 2) & 0b1111) {
+				case alu_op::ADD:  value = a + " + " + b; break;
+				case alu_op::SUB:  value = a + " - " + b; break;
+				case alu_op::SL:
+				case alu_op::LSL:  value = a + " << (" + b + " & 31)"; break;
+				case alu_op::SR:   value = "(uint32_t)((int32_t)" + a + " >> (" + b + " & 31))"; break;
+				case alu_op::LSR:  value = a + " >> (" + b + " & 31)"; break;
+				case alu_op::MUL:  value = a + " * " + b; break;
+				case alu_op::MULH: value = "mcpu_mulh(" + a + ", " + b + ")"; break;
+				case alu_op::OR:   value = a + " | " + b; break;
+				case alu_op::EOR:  value = a + " ^ " + b; break;
+				case alu_op::AND:  value = a + " & " + b; break;
+				case alu_op::DIV:  value = "mcpu_div(" + a + ", " + b + ")"; break;
+				case alu_op::NOR:  value = "~(" + a + " | " + b + ")"; break;
+				case alu_op::ENOR: value = "~(" + a + " ^ " + b + ")"; break;
+				case alu_op::NAND: value = "~(" + a + " & " + b + ")"; break;
+				default:           value = "mcpu_mod(" + a + ", " + b + ")"; break;
+			}
+			write(pc, d.rd, "", value, f);
+		}
+
+		// Write the block out, returning the C for the whole function
+		std::string translate() {
+			uint32_t pc = start;
+			for (bool first = true;; first = false) {
+				// run into the next block, or off the end of what was found
+				auto it = prog.code.find(pc);
+				if (it == prog.code.end() || (!first && prog.leaders.count(pc))) {
+					exit(hex(pc), count, false);
+					break;
+				}
+
+				const auto& d = it->second.d;
+				auto f = analyse(pc, d);
+
+				std::string text;
+				uint8_t bytes[4] = {(uint8_t)it->second.raw, (uint8_t)(it->second.raw >> 8), (uint8_t)(it->second.raw >> 16), (uint8_t)(it->second.raw >> 24)};
+				mdis::disassemble_insn(bytes, d.length(), pc, text);
+				char addr[16];
+				snprintf(addr, sizeof addr, "%08x", pc);
+				line("// " + std::string(addr) + "  " + text);
+
+				switch (d.opcode >> 5) {
+					case 0b00: load_store(pc, d, f); break;
+					case 0b01: mov(pc, d, f); break;
+					default:   alu(pc, d, f); break;
+				}
+				// an access that always goes to the model ends the block before it
+				if (f.cpureg) break;
+				++count;
+				pc += d.length();
+				if (f.writes_pc && !f.conditional) break;
+			}
+
+			std::string out = "static uint32_t " + block_name(start) + "(struct mcpu_aot *m, uint32_t *r)\n{\n";
+			for (uint32_t r : used) out += "\tuint32_t r" + std::to_string(r) + " = r[" + std::to_string(r) + "];\n";
+			if (used.empty()) out += "\t(void)r;\n";
+			out += "\tuint32_t next, n, taken;\n";
+			if (memory) out += loads ? "\tuint32_t a, v;\n" : "\tuint32_t a;\n";
+			if (loops) out += "top:\n";
+			// the last exit doesn't need to jump to the code right after it
+			if (body.ends_with("\tgoto out;\n")) body.resize(body.rfind('\t'));
+			out += body;
+			if (exits) out += body.find("goto out;") == std::string::npos ? "\tmcpu_aot_retire(m, n, taken);\n" : "out:\n\tmcpu_aot_retire(m, n, taken);\n";
+			if (loops) out += "spill:\n";
+			for (uint32_t r : written) out += "\tr[" + std::to_string(r) + "] = r" + std::to_string(r) + ";\n";
+			out += "\treturn next;\n}\n\n";
+			return out;
+		}
+	};
+
+	const char *preamble =
+		"#include \"mcpu_aot.h\"\n"
+		"\n"
+		"// the divider's results where C leaves them undefined\n"
+		"static inline uint32_t mcpu_div(uint32_t a, uint32_t b)\n"
+		"{\n"
+		"\tif (!b) return 0xffffffffu;\n"
+		"\tif (a == 0x80000000u && b == 0xffffffffu) return a;\n"
+		"\treturn (uint32_t)((int32_t)a / (int32_t)b);\n"
+		"}\n"
+		"\n"
+		"static inline uint32_t mcpu_mod(uint32_t a, uint32_t b)\n"
+		"{\n"
+		"\tif (!b) return a;\n"
+		"\tif (a == 0x80000000u && b == 0xffffffffu) return 0;\n"
+		"\treturn (uint32_t)((int32_t)a % (int32_t)b);\n"
+		"}\n"
+		"\n"
+		"static inline uint32_t mcpu_mulh(uint32_t a, uint32_t b)\n"
+		"{\n"
+		"\treturn (uint32_t)(((int64_t)(int32_t)a * (int32_t)b) >> 32);\n"
+		"}\n"
+		"\n";
+}
+
+int main(int argc, char ** argv) {
+	options opt;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--entry") {
+			if (i + 1 >= argc) {
+				usage();
+				return 2;
+			}
+			opt.entries.push_back(strtoul(argv[++i], nullptr, 0));
+		}
+		else if (opt.image.empty() && arg[0] != '-') opt.image = arg;
+		else if (opt.output.empty() && arg[0] != '-') opt.output = arg;
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (opt.output.empty()) {
+		usage();
+		return 2;
+	}
+
+	std::vector<uint8_t> raw;
+	program prog;
+	try {
+		FILE *f = fopen(opt.image.c_str(), "rb");
+		if (!f) throw std::runtime_error("unable to open image " + opt.image);
+		uint8_t buf[4096];
+		for (size_t n; (n = fread(buf, 1, sizeof buf, f)) > 0;) raw.insert(raw.end(), buf, buf + n);
+		fclose(f);
+		prog.sections = msim::parse_image(raw.data(), raw.size());
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "mcpu-aot: %s\n", e.what());
+		return 2;
+	}
+
+	prog.discover(opt.entries);
+
+	std::string out = "// Translated from " + opt.image + " by mcpu-aot\n\n";
+	out += preamble;
+	for (uint32_t start : prog.leaders) out += block_writer{prog, start}.translate();
+
+	out += "mcpu_aot_block *mcpu_aot_lookup(uint32_t pc)\n{\n\tswitch (pc) {\n";
+	for (uint32_t start : prog.leaders) out += "\tcase " + hex(start) + ": return " + block_name(start) + ";\n";
+	out += "\tdefault: return 0;\n\t}\n}\n\n";
+
+	// (never empty, which C doesn't allow)
+	out += "const uint8_t mcpu_aot_image[] = {";
+	if (raw.empty()) out += "0";
+	for (size_t i = 0; i < raw.size(); ++i) {
+		char byte[8];
+		snprintf(byte, sizeof byte, "%s0x%02x,", i % 16 ? " " : "\n\t", raw[i]);
+		out += byte;
+	}
+	out += "\n};\nconst size_t mcpu_aot_image_size = " + std::to_string(raw.size()) + ";\n";
+
+	FILE *f = fopen(opt.output.c_str(), "w");
+	if (!f || fwrite(out.data(), 1, out.size(), f) != out.size() || fclose(f)) {
+		fprintf(stderr, "mcpu-aot: unable to write %s\n", opt.output.c_str());
+		return 2;
+	}
+	printf("mcpu-aot: %zu blocks, %zu instructions\n", prog.leaders.size(), prog.code.size());
+	return 0;
+}
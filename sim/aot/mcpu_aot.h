@@ -0,0 +1,44 @@
+#pragma once
+
+// Interface between the C that mcpu-aot translates an image into and the runtime it links against
+// (runtime.cpp), which owns the memory and cpu state and runs anything the translation didn't
+// cover on the reference model. The generated side is plain C99.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mcpu_aot;
+
+// A translated basic block. r is the current task's registers (r[15] is never used, the pc is
+// implied by the block); returns the pc to continue at.
+typedef uint32_t mcpu_aot_block(struct mcpu_aot *m, uint32_t *r);
+
+// From the generated file: the image it was translated from, and the block starting at an
+// address (or NULL if none does)
+extern const uint8_t mcpu_aot_image[];
+extern const size_t mcpu_aot_image_size;
+mcpu_aot_block *mcpu_aot_lookup(uint32_t pc);
+
+// From the runtime:
+
+// Bus word accesses, as the cpu does them. Never the cpu register block, the model does those.
+uint16_t mcpu_aot_read(struct mcpu_aot *m, uint32_t addr);
+void mcpu_aot_write(struct mcpu_aot *m, uint32_t addr, uint16_t value, uint8_t mask);
+
+// Count n retired instructions, taken of which wrote pc. Nonzero once the run is out of
+// instructions, so a loop inside a block knows to return.
+int mcpu_aot_retire(struct mcpu_aot *m, uint32_t n, uint32_t taken);
+
+// The block is returning the pc of an instruction it can't run, which the model should execute
+void mcpu_aot_step(struct mcpu_aot *m);
+
+// The block is returning the pc of a jump to itself, which is how programs stop
+void mcpu_aot_halt(struct mcpu_aot *m);
+
+#ifdef __cplusplus
+}
+#endif
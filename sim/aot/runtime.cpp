@@ -0,0 +1,120 @@
+// Runtime for programs translated by mcpu-aot.
+//
+// Runs the translated blocks against the reference model's memory and registers, and falls back to
+// stepping the model for anything without a block: code that wasn't found statically, cpu register
+// accesses, and everything once MEM_LAYOUT moves away from the layout the image was translated for.
+// There are no interrupt sources, so a jump to itself always stops the program.
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "image.h"
+#include "mcpu_aot.h"
+#include "memory.h"
+#include "model.h"
+
+struct mcpu_aot {
+	msim::memory mem;
+	msim::cpu cpu{mem};
+
+	// the task the current block runs in
+	uint32_t task = 0;
+
+	uint64_t retired = 0, stepped = 0, max_insns = 0;
+	bool step = false, halted = false;
+};
+
+extern "C" {
+	uint16_t mcpu_aot_read(mcpu_aot *m, uint32_t addr) {
+		return m->mem.read16(addr, m->cpu.mem_layout);
+	}
+
+	void mcpu_aot_write(mcpu_aot *m, uint32_t addr, uint16_t value, uint8_t mask) {
+		m->mem.write16(addr, value, mask, m->cpu.mem_layout);
+	}
+
+	int mcpu_aot_retire(mcpu_aot *m, uint32_t n, uint32_t taken) {
+		// a block only ever runs in one task, as switching goes through the model
+		auto& perf = m->cpu.perf[m->task];
+		perf[msim::cpu::PERF_CYCLES] += n;
+		perf[msim::cpu::PERF_RETIRED] += n;
+		perf[msim::cpu::PERF_TAKEN] += taken;
+		m->retired += n;
+		return m->retired >= m->max_insns;
+	}
+
+	void mcpu_aot_step(mcpu_aot *m) {
+		m->step = true;
+	}
+
+	void mcpu_aot_halt(mcpu_aot *m) {
+		m->halted = true;
+	}
+}
+
+namespace {
+	void usage(const char *name) {
+		fprintf(stderr,
+			"usage: %s [options]\n"
+			"  --max-insns N       stop after N instructions\n"
+			"  --model             run everything on the model, for comparison\n",
+			name
+		);
+	}
+
+	void run(mcpu_aot& m, bool translated) {
+		auto& cpu = m.cpu;
+		while (!m.halted && m.retired < m.max_insns) {
+			uint32_t pc = cpu.pc();
+			mcpu_aot_block *block = translated && cpu.mem_layout == msim::reset_mem_layout ? mcpu_aot_lookup(pc) : nullptr;
+			if (block) {
+				m.task = cpu.task_active;
+				cpu.regs[m.task][15] = block(&m, cpu.regs[m.task]);
+				if (!m.step) continue;
+				m.step = false;
+				if (m.retired >= m.max_insns) break;
+			}
+
+			auto r = cpu.step();
+			++m.retired;
+			++m.stepped;
+			if (!r.irq && r.next_pc == r.pc) m.halted = true;
+		}
+	}
+}
+
+int main(int argc, char ** argv) {
+	auto m = std::make_unique<mcpu_aot>();
+	m->max_insns = 1'000'000'000;
+	bool translated = true;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--max-insns" && i + 1 < argc) m->max_insns = strtoull(argv[++i], nullptr, 0);
+		else if (arg == "--model") translated = false;
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	try {
+		m->mem.load(msim::parse_image(mcpu_aot_image, mcpu_aot_image_size));
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s: %s\n", argv[0], e.what());
+		return 2;
+	}
+
+	run(*m, translated);
+
+	const auto& cpu = m->cpu;
+	if (m->halted) printf("halted at %08x", cpu.pc());
+	else printf("stopped at %08x without halting", cpu.pc());
+	printf(" after %llu instructions (%llu on the model) in task %u\n",
+		(unsigned long long)m->retired, (unsigned long long)m->stepped, cpu.task_active);
+	for (int i = 1; i < 15; ++i) printf("r%-2d %08x%s", i, cpu.regs[cpu.task_active][i], i % 7 ? "  " : "\n");
+	return m->halted ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+// Cycle-approximate execution of an mcasm image on the reference model.
+//
+// Every retired instruction is charged its issue cost plus the stalls its fetch and data accesses
+// would see on the bus target they hit under the MEM_LAYOUT at the time, so the same program can be
+// compared across memory layouts (or timing files) without running the RTL. The estimate is also
+// fed back into the PERF_CYCLES and PERF_STALL counters, so code that times itself sees it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "image.h"
+#include "memory.h"
+#include "model.h"
+#include "timing.h"
+
+namespace {
+	struct options {
+		std::string image;
+		std::string timing;
+		uint64_t max_cycles = 100'000'000;
+		int irq_line = -1;
+		uint64_t irq_period = 0;
+	};
+
+	void usage() {
+		fputs(
+			"usage: mcpu-perf [options] image.bin\n"
+			"  --timing FILE       cycle costs and bus latencies (see sim/src/timing.h)\n"
+			"  --max-cycles N      stop after N estimated cycles\n"
+			"  --irq LINE:PERIOD   raise an interrupt line every PERIOD estimated cycles\n",
+			stderr
+		);
+	}
+
+	double percent(uint64_t part, uint64_t whole) {
+		return whole ? 100.0 * part / whole : 0.0;
+	}
+
+	void report(const msim::estimate& e) {
+		printf("%12llu cycles\n", (unsigned long long)e.cycles);
+		printf("%12llu retired (%.2f cycles per instruction)\n", (unsigned long long)e.retired, e.retired ? (double)e.cycles / e.retired : 0.0);
+		printf("%12llu taken jumps\n", (unsigned long long)e.taken);
+		printf("%12llu interrupts\n\n", (unsigned long long)e.irqs);
+
+		printf("%12llu issue      (%5.1f%%)\n", (unsigned long long)e.issue, percent(e.issue, e.cycles));
+		printf("%12llu refill     (%5.1f%%)\n", (unsigned long long)e.refill, percent(e.refill, e.cycles));
+		printf("%12llu irq entry  (%5.1f%%)\n", (unsigned long long)e.irq_entry, percent(e.irq_entry, e.cycles));
+		printf("%12llu stall      (%5.1f%%)\n\n", (unsigned long long)e.stall(), percent(e.stall(), e.cycles));
+
+		printf("%-10s %12s %12s %12s %12s\n", "target", "fetches", "fetch stall", "accesses", "data stall");
+		for (size_t i = 0; i < msim::target_count; ++i) {
+			if (!e.fetches[i] && !e.accesses[i]) continue;
+			printf("%-10s %12llu %12llu %12llu %12llu\n", msim::target_name((msim::target)i),
+				(unsigned long long)e.fetches[i], (unsigned long long)e.fetch_stall[i],
+				(unsigned long long)e.accesses[i], (unsigned long long)e.data_stall[i]);
+		}
+	}
+}
+
+int main(int argc, char ** argv) {
+	options opt;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto value = [&]() -> const char * {
+			if (i + 1 >= argc) {
+				usage();
+				exit(2);
+			}
+			return argv[++i];
+		};
+
+		if (arg == "--timing") opt.timing = value();
+		else if (arg == "--max-cycles") opt.max_cycles = strtoull(value(), nullptr, 0);
+		else if (arg == "--irq") {
+			const char *v = value();
+			char *end;
+			opt.irq_line = strtol(v, &end, 0);
+			if (*end != ':' || opt.irq_line < 0 || opt.irq_line > 15) {
+				usage();
+				return 2;
+			}
+			opt.irq_period = strtoull(end + 1, nullptr, 0);
+		}
+		else if (opt.image.empty() && arg[0] != '-') opt.image = arg;
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (opt.image.empty()) {
+		usage();
+		return 2;
+	}
+
+	msim::timing timing;
+	std::unique_ptr<msim::mapped_image> image;
+	try {
+		if (!opt.timing.empty()) timing.load(opt.timing);
+		image = std::make_unique<msim::mapped_image>(opt.image);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "mcpu-perf: %s\n", e.what());
+		return 2;
+	}
+
+	msim::memory mem;
+	mem.load(image->sections());
+	msim::cpu cpu(mem);
+
+	msim::estimate est;
+	bool stimulus = opt.irq_line >= 0 && opt.irq_period;
+	uint64_t next_irq_at = opt.irq_period;
+
+	while (est.cycles < opt.max_cycles) {
+		// the instruction may change MEM_LAYOUT, but it was fetched under the old one
+		uint32_t layout = cpu.mem_layout;
+		uint64_t stalled = est.stall();
+		auto r = cpu.step();
+		uint64_t spent = est.add(r, layout, timing);
+
+		// the model counts one cycle per instruction (and none for interrupt entry)
+		cpu.perf[r.task][msim::cpu::PERF_CYCLES] += spent - (r.irq ? 0 : 1);
+		cpu.perf[r.task][msim::cpu::PERF_STALL] += est.stall() - stalled;
+
+		while (stimulus && est.cycles >= next_irq_at) {
+			cpu.raise_irq(opt.irq_line);
+			next_irq_at += opt.irq_period;
+		}
+
+		// a jump to itself that nothing can interrupt is how programs stop
+		if (!r.irq && r.next_pc == r.pc && cpu.next_irq() < 0 && (!stimulus || !(cpu.irq_en & (1u << opt.irq_line)))) {
+			printf("mcpu-perf: halted at %08x\n\n", r.pc);
+			report(est);
+			return 0;
+		}
+	}
+
+	printf("mcpu-perf: stopped after %llu cycles without halting\n\n", (unsigned long long)opt.max_cycles);
+	report(est);
+	return 1;
+}
@@ -0,0 +1,109 @@
+#include "image.h"
+#include "imgfmt.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace msim {
+	namespace {
+		uint64_t get(const uint8_t *p, int bytes) {
+			uint64_t v = 0;
+			for (int i = 0; i < bytes; ++i) v |= (uint64_t)p[i] << (i * 8);
+			return v;
+		}
+
+		std::vector<image_view> view_paged(const uint8_t *data, size_t length) {
+			namespace fmt = masm::imgfmt;
+			if (length < fmt::paged_header_size) throw std::runtime_error("truncated header in paged image");
+			if (get(data + 0x08, 4) != fmt::paged_version) throw std::runtime_error("unsupported paged image version");
+
+			uint64_t count = get(data + 0x10, 4);
+			if ((length - fmt::paged_header_size) / fmt::paged_entry_size < count) throw std::runtime_error("truncated section index in paged image");
+
+			std::vector<image_view> views;
+			for (uint64_t i = 0; i < count; ++i) {
+				const uint8_t *e = data + fmt::paged_header_size + i * fmt::paged_entry_size;
+				image_view& v = views.emplace_back();
+				v.base_address = get(e, 4);
+				v.length = get(e + 4, 4);
+				uint64_t offset = get(e + 8, 8);
+				if (offset > length || length - offset < v.length) throw std::runtime_error("truncated section contents in paged image");
+				v.data = data + offset;
+			}
+			return views;
+		}
+	}
+
+	std::vector<image_view> view_image(const uint8_t *data, size_t length) {
+		if (length >= sizeof masm::imgfmt::paged_magic && !memcmp(data, masm::imgfmt::paged_magic, sizeof masm::imgfmt::paged_magic))
+			return view_paged(data, length);
+
+		std::vector<image_view> views;
+		size_t ptr = 0;
+		while (ptr < length) {
+			if (length - ptr < 8) throw std::runtime_error("truncated section header in image");
+			image_view &v = views.emplace_back();
+			v.base_address = get(data + ptr, 4);
+			v.length = get(data + ptr + 4, 4);
+			ptr += 8;
+			if (length - ptr < v.length) throw std::runtime_error("truncated section contents in image");
+			v.data = data + ptr;
+			ptr += v.length;
+		}
+
+		return views;
+	}
+
+	std::vector<image_section> parse_image(const uint8_t *data, size_t length) {
+		std::vector<image_section> sections;
+		for (const auto& v : view_image(data, length)) sections.push_back({v.base_address, std::vector<uint8_t>(v.data, v.data + v.length)});
+		return sections;
+	}
+
+	std::vector<image_section> load_image(const std::string& path) {
+		mapped_image m(path);
+		std::vector<image_section> sections;
+		for (const auto& v : m.sections()) sections.push_back({v.base_address, std::vector<uint8_t>(v.data, v.data + v.length)});
+		return sections;
+	}
+
+	mapped_image::mapped_image(const std::string& path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("unable to open image " + path + ": " + strerror(errno));
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			close(fd);
+			throw std::runtime_error("unable to stat image " + path + ": " + strerror(errno));
+		}
+		length = st.st_size;
+
+		// mmap refuses empty files, which are empty images anyway
+		if (length) {
+			void *m = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (m == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("unable to map image " + path + ": " + strerror(errno));
+			}
+			data = (const uint8_t *)m;
+		}
+		close(fd);
+
+		try {
+			views = view_image(data, length);
+		}
+		catch (...) {
+			if (data) munmap((void *)data, length);
+			throw;
+		}
+	}
+
+	mapped_image::~mapped_image() {
+		if (data) munmap((void *)data, length);
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace msim {
+	// One section of an mcasm output image
+	struct image_section {
+		uint32_t base_address = 0;
+		std::vector<uint8_t> data;
+	};
+
+	// A section whose contents live somewhere else, in a mapped file or an image_section
+	struct image_view {
+		uint32_t base_address = 0;
+		const uint8_t *data = nullptr;
+		size_t length = 0;
+	};
+
+	// Load an mcasm image, either a stream of (base, length, bytes) records or a paged image (see
+	// imgfmt.h), throwing std::runtime_error if it is truncated or malformed.
+	std::vector<image_section> load_image(const std::string& path);
+	std::vector<image_section> parse_image(const uint8_t *data, size_t length);
+	// The same without copying anything; the views point into data
+	std::vector<image_view> view_image(const uint8_t *data, size_t length);
+
+	// An image file mapped rather than read, so the sections of a paged image are never copied
+	// until they are loaded into memory. Throws like load_image.
+	struct mapped_image {
+		explicit mapped_image(const std::string& path);
+		~mapped_image();
+
+		mapped_image(const mapped_image&) = delete;
+		mapped_image& operator=(const mapped_image&) = delete;
+
+		const std::vector<image_view>& sections() const {return views;}
+
+	private:
+		const uint8_t *data = nullptr;
+		size_t length = 0;
+		std::vector<image_view> views;
+	};
+}
@@ -0,0 +1,91 @@
+#include "memory.h"
+#include <algorithm>
+#include <cstring>
+
+namespace msim {
+	target target_for(uint32_t addr, uint32_t mem_layout) {
+		switch (addr >> 30) {
+			case 0b00:
+				return static_cast<target>(mem_layout & 0b11);
+			case 0b01:
+				return static_cast<target>((mem_layout >> 2) & 0b11);
+			case 0b10:
+				return target::CPUREGS;
+			default:
+				return target::VRAM;
+		}
+	}
+
+	backing::backing(size_t size) : size_(size), pages((size + (1 << page_bits) - 1) >> page_bits) {}
+
+	uint8_t backing::read(uint32_t offset) const {
+		offset %= size_;
+		const auto& page = pages[offset >> page_bits];
+		return page ? page[offset & ((1 << page_bits) - 1)] : 0;
+	}
+
+	void backing::write(uint32_t offset, uint8_t value) {
+		offset %= size_;
+		auto& page = pages[offset >> page_bits];
+		if (!page) page = std::make_unique<uint8_t[]>(1 << page_bits);
+		page[offset & ((1 << page_bits) - 1)] = value;
+	}
+
+	void backing::write(uint32_t offset, const uint8_t *data, size_t length) {
+		constexpr size_t page_size = 1 << page_bits;
+		while (length) {
+			offset %= size_;
+			size_t within = offset & (page_size - 1);
+			size_t n = std::min(length, page_size - within);
+			auto& page = pages[offset >> page_bits];
+			if (!page) page = std::make_unique<uint8_t[]>(page_size);
+			memcpy(page.get() + within, data, n);
+			offset += n;
+			data += n;
+			length -= n;
+		}
+	}
+
+	const backing *memory::resolve(uint32_t addr, uint32_t mem_layout) const {
+		switch (target_for(addr, mem_layout)) {
+			case target::ROM:   return &rom;
+			case target::SRAM:  return &sram;
+			case target::SDRAM: return &sdram;
+			case target::VRAM:  return &vram;
+			default:            return nullptr;
+		}
+	}
+
+	uint16_t memory::read16(uint32_t addr, uint32_t mem_layout) const {
+		const backing *b = resolve(addr, mem_layout);
+		if (!b) return 0;
+		uint32_t offset = (addr & 0x3fff'fffe);
+		return b->read(offset) | (b->read(offset + 1) << 8);
+	}
+
+	void memory::write16(uint32_t addr, uint16_t value, uint8_t mask, uint32_t mem_layout, bool force) {
+		backing *b = const_cast<backing *>(resolve(addr, mem_layout));
+		if (!b || (b == &rom && !force)) return;
+		uint32_t offset = (addr & 0x3fff'fffe);
+		if (mask & 1) b->write(offset, value & 0xff);
+		if (mask & 2) b->write(offset + 1, value >> 8);
+	}
+
+	void memory::load(const std::vector<image_section>& sections) {
+		std::vector<image_view> views;
+		for (const auto& section : sections) views.push_back({section.base_address, section.data.data(), section.data.size()});
+		load(views);
+	}
+
+	void memory::load(const std::vector<image_view>& sections) {
+		for (const auto& section : sections) {
+			// a quadrant at a time, as each can be a different target
+			for (size_t i = 0; i < section.length;) {
+				uint32_t addr = section.base_address + i;
+				size_t n = std::min<size_t>(section.length - i, 0x4000'0000 - (addr & 0x3fff'ffff));
+				if (auto *b = const_cast<backing *>(resolve(addr, reset_mem_layout))) b->write(addr & 0x3fff'ffff, section.data + i, n);
+				i += n;
+			}
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "image.h"
+
+namespace msim {
+	// Bus targets the two remappable quadrants can be pointed at with MEM_LAYOUT, plus the
+	// fixed targets in the upper quadrants.
+	enum class target : uint32_t {
+		ROM = 0b00,
+		SRAM = 0b01,
+		SDRAM = 0b10,
+		UNMAPPED = 0b11,
+		CPUREGS,
+		VRAM
+	};
+
+	// MEM_LAYOUT at reset: region 1 -> internal ROM, region 2 -> internal SRAM
+	inline constexpr uint32_t reset_mem_layout = 0b0100;
+
+	// Which target is selected by an address given the current MEM_LAYOUT
+	target target_for(uint32_t addr, uint32_t mem_layout);
+
+	// Sparse byte store, pages are only allocated once written to. Offsets wrap at the size.
+	struct backing {
+		explicit backing(size_t size);
+
+		uint8_t read(uint32_t offset) const;
+		void write(uint32_t offset, uint8_t value);
+		// Copy length bytes in a page at a time
+		void write(uint32_t offset, const uint8_t *data, size_t length);
+
+		size_t size() const {return size_;}
+
+	private:
+		static constexpr size_t page_bits = 12;
+
+		size_t size_;
+		std::vector<std::unique_ptr<uint8_t[]>> pages;
+	};
+
+	// Everything on the external side of the cpu's bus. Accesses are halfword (bus word) wide,
+	// with a byte mask for writes.
+	struct memory {
+		static constexpr size_t rom_size   = 64 * 1024;
+		static constexpr size_t sram_size  = 64 * 1024;
+		static constexpr size_t sdram_size = 256 * 1024 * 1024;
+		static constexpr size_t vram_size  = 1024 * 1024;
+
+		backing rom{rom_size}, sram{sram_size}, sdram{sdram_size}, vram{vram_size};
+
+		// Read the bus word containing addr
+		uint16_t read16(uint32_t addr, uint32_t mem_layout) const;
+		// Write the bus word containing addr; bit 0 of mask enables the low (even) byte. Writes
+		// to ROM are dropped unless forced.
+		void write16(uint32_t addr, uint16_t value, uint8_t mask, uint32_t mem_layout, bool force=false);
+
+		// Place image sections using the reset memory layout
+		void load(const std::vector<image_section>& sections);
+		void load(const std::vector<image_view>& sections);
+
+	private:
+		const backing *resolve(uint32_t addr, uint32_t mem_layout) const;
+	};
+}
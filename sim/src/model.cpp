@@ -0,0 +1,348 @@
+#include "model.h"
+
+namespace msim {
+	using namespace masm::insn;
+
+	namespace {
+		// offsets into the cpu register block, mirroring lib/cpuregs.inc
+		constexpr uint32_t cpureg_irq_base = 0x00;
+		constexpr uint32_t cpureg_irq_en = 0x04;
+		constexpr uint32_t cpureg_task_active = 0x10;
+		constexpr uint32_t cpureg_mem_layout = 0x40;
+		constexpr uint32_t cpureg_perf_reset = 0x50;
+		constexpr uint32_t cpureg_perf_cnt = 0x80;
+		constexpr uint32_t cpureg_task_ctx = 0x100;
+		constexpr uint32_t cpureg_end = 0x200;
+
+		uint32_t sext(uint32_t value, int bits) {
+			uint32_t m = 1u << (bits - 1);
+			return ((value & ((1u << bits) - 1)) ^ m) - m;
+		}
+
+		uint16_t merge(uint16_t old, uint16_t value, uint8_t mask) {
+			uint16_t m = (mask & 1 ? 0x00ff : 0) | (mask & 2 ? 0xff00 : 0);
+			return (old & ~m) | (value & m);
+		}
+
+		bool condition(uint32_t cond, uint32_t op1, uint32_t op2) {
+			switch (cond) {
+				case mov_cond::LT:  return op1 < op2;
+				case mov_cond::SLT: return (int32_t)op1 < (int32_t)op2;
+				case mov_cond::GE:  return op1 >= op2;
+				case mov_cond::SGE: return (int32_t)op1 >= (int32_t)op2;
+				case mov_cond::EQ:  return op1 == op2;
+				case mov_cond::NEQ: return op1 != op2;
+				case mov_cond::BS:  return (op1 & op2) != 0;
+				default:            return true;
+			}
+		}
+
+		uint32_t alu(uint32_t op, uint32_t a, uint32_t b) {
+			switch (op) {
+				case alu_op::ADD:  return a + b;
+				case alu_op::SUB:  return a - b;
+				case alu_op::SL:
+				case alu_op::LSL:  return a << (b & 31);
+				case alu_op::SR:   return (uint32_t)((int32_t)a >> (b & 31));
+				case alu_op::LSR:  return a >> (b & 31);
+				case alu_op::MUL:  return a * b;
+				case alu_op::MULH: return (uint32_t)(((int64_t)(int32_t)a * (int32_t)b) >> 32);
+				case alu_op::OR:   return a | b;
+				case alu_op::EOR:  return a ^ b;
+				case alu_op::AND:  return a & b;
+				case alu_op::NOR:  return ~(a | b);
+				case alu_op::ENOR: return ~(a ^ b);
+				case alu_op::NAND: return ~(a & b);
+				// same results as the divider in the core for the cases C leaves undefined
+				case alu_op::DIV:
+					if (!b) return 0xffff'ffff;
+					if (a == 0x8000'0000 && b == 0xffff'ffff) return a;
+					return (uint32_t)((int32_t)a / (int32_t)b);
+				case alu_op::MOD:
+					if (!b) return a;
+					if (a == 0x8000'0000 && b == 0xffff'ffff) return 0;
+					return (uint32_t)((int32_t)a % (int32_t)b);
+				default:           return 0;
+			}
+		}
+	}
+
+	cpu::cpu(memory &mem) : mem(mem) {
+		reset();
+	}
+
+	void cpu::reset() {
+		for (auto& ctx : regs) for (auto& r : ctx) r = 0;
+		irq_base = irq_base_shadow = 0;
+		irq_en = irq_pending = 0;
+		task_active = 0;
+		mem_layout = reset_mem_layout;
+		for (auto& ctx : perf) for (auto& c : ctx) c = 0;
+		perf_shadow = 0;
+	}
+
+	uint32_t cpu::reg(uint32_t r) const {
+		return r == 0 ? 0 : regs[task_active][r];
+	}
+
+	int cpu::next_irq() const {
+		// context 3 is the interrupt context; interrupts never nest
+		if (task_active == 3) return -1;
+		uint32_t ready = irq_pending & irq_en & 0xffff;
+		if (!ready) return -1;
+		return __builtin_ctz(ready);
+	}
+
+	retire cpu::enter_irq(uint32_t number) {
+		retire r;
+		r.irq = true;
+		r.irq_number = number;
+		r.task = task_active;
+		r.pc = pc();
+
+		irq_pending &= ~(1u << number);
+		regs[3][14] = task_active;
+		task_active = 3;
+		regs[3][15] = irq_base | (number << 4);
+
+		r.next_pc = regs[3][15];
+		r.taken = true;
+		return r;
+	}
+
+	retire cpu::step() {
+		if (auto_irq) {
+			if (int n = next_irq(); n >= 0) return enter_irq(n);
+		}
+
+		retire r;
+		r.task = task_active;
+		r.pc = pc();
+
+		uint32_t raw = bus_read(r.pc);
+		if (is_long_halfword(raw)) raw |= (uint32_t)bus_read(r.pc + 2) << 16;
+		r.raw = raw;
+
+		auto d = decode(raw);
+		r.next_pc = r.pc + d.length();
+
+		uint32_t task = task_active; // stores can switch context mid-instruction
+		execute(d, r);
+		regs[task][15] = r.next_pc;
+
+		++perf[task][PERF_CYCLES];
+		++perf[task][PERF_RETIRED];
+		if (r.taken) ++perf[task][PERF_TAKEN];
+		return r;
+	}
+
+	void cpu::execute(const decoded& d, retire& r) {
+		bool has_result = false;
+		uint32_t result = 0;
+
+		switch (d.opcode >> 5) {
+			case 0b00:
+				{
+					// load/store
+					uint32_t kind = (d.opcode >> 4) & 1;
+					uint32_t size = (d.opcode >> 3) & 1;
+					uint32_t dest = (d.opcode >> 1) & 0b11;
+
+					uint32_t addr;
+					switch (d.fmt) {
+						case format::T:
+							addr = d.imm + reg(d.ro) + (reg(d.rs) << d.FF);
+							break;
+						case format::F:
+							addr = ((d.FF << 30) | ((uint32_t)d.imm & 0x3fff'ffff)) + reg(d.ro);
+							break;
+						default:
+							addr = reg(d.ro);
+							break;
+					}
+
+					if (kind == load_store_kind::STORE) {
+						uint32_t data = dest == load_store_dest::HIGHW ? reg(d.rd) >> 16 : reg(d.rd) & 0xffff;
+						uint8_t mask = 0b11;
+						if (size == load_store_size::BYTE) {
+							mask = 1 << (addr & 1);
+							data = (data & 0xff) << ((addr & 1) * 8);
+						}
+						r.store = true;
+						r.store_addr = addr;
+						r.store_data = data;
+						r.store_mask = mask;
+						bus_write(addr, data, mask);
+					}
+					else {
+						uint32_t value = bus_read(addr);
+						if (size == load_store_size::BYTE) value = (value >> ((addr & 1) * 8)) & 0xff;
+						r.load = true;
+						r.load_addr = addr;
+						r.load_volatile = target_for(addr, mem_layout) == target::CPUREGS &&
+							(addr & 0x3fff'ffff) >= cpureg_perf_cnt && (addr & 0x3fff'ffff) < cpureg_task_ctx;
+
+						has_result = true;
+						switch (dest) {
+							case load_store_dest::ZEXT:
+								result = value;
+								break;
+							case load_store_dest::SEXT:
+								result = sext(value, size == load_store_size::BYTE ? 8 : 16);
+								break;
+							case load_store_dest::LOWW:
+								result = (reg(d.rd) & 0xffff'0000) | value;
+								break;
+							case load_store_dest::HIGHW:
+								result = (reg(d.rd) & 0x0000'ffff) | (value << 16);
+								break;
+						}
+					}
+				}
+				break;
+			case 0b01:
+				{
+					// mov/jmp
+					uint32_t cond = (d.opcode >> 2) & 0b111;
+					uint32_t op = d.opcode & 0b11;
+					uint32_t op1 = reg(d.rs), op2 = reg(d.ro);
+
+					if (d.FF == 0b01) op1 = d.imm;
+					else if (d.FF == 0b10) op2 = d.imm;
+
+					switch (op) {
+						case mov_op::MIMM: result = d.imm; break;
+						case mov_op::JUMP: result = reg(d.rd); break;
+						case mov_op::MRS:  result = reg(d.rs); break;
+						case mov_op::MRO:  result = reg(d.ro); break;
+					}
+					if (d.FF == 0b11) result += d.imm;
+
+					if (condition(cond, op1, op2)) {
+						if (op == mov_op::JUMP) {
+							r.next_pc = result;
+							r.taken = true;
+						}
+						else has_result = true;
+					}
+				}
+				break;
+			default:
+				{
+					// alu
+					uint32_t a, b;
+					switch (d.opcode & 0b11) {
+						case alu_sty::REG:
+							a = reg(d.rs);
+							b = reg(d.ro);
+							break;
+						case alu_sty::IMM:
+							a = d.fmt == format::A ? reg(d.rs) : reg(d.ro);
+							b = d.imm;
+							break;
+						case alu_sty::REGSL:
+							a = reg(d.rs);
+							b = reg(d.ro) << (d.FF + 1);
+							break;
+						default:
+							a = reg(d.rs);
+							b = reg(d.ro) >> (d.FF + 1);
+							break;
+					}
+					has_result = true;
+					result = alu((d.opcode >> 2) & 0b1111, a, b);
+				}
+				break;
+		}
+
+		if (!has_result || d.rd == 0) return;
+		if (d.rd == 15) {
+			r.next_pc = result;
+			r.taken = true;
+			return;
+		}
+		regs[r.task][d.rd] = result;
+		r.wb = true;
+		r.wb_reg = d.rd;
+		r.wb_value = result;
+	}
+
+	uint16_t cpu::bus_read(uint32_t addr) {
+		if (target_for(addr, mem_layout) == target::CPUREGS) return cpureg_read(addr);
+		return mem.read16(addr, mem_layout);
+	}
+
+	void cpu::bus_write(uint32_t addr, uint16_t value, uint8_t mask) {
+		if (target_for(addr, mem_layout) == target::CPUREGS) cpureg_write(addr, value, mask);
+		else mem.write16(addr, value, mask, mem_layout);
+	}
+
+	uint16_t cpu::cpureg_read(uint32_t addr) {
+		uint32_t off = (addr & 0x3fff'fffe);
+		if (off >= cpureg_end) return 0;
+		if (off >= cpureg_perf_cnt && off < cpureg_task_ctx) {
+			uint64_t &counter = perf[(off - cpureg_perf_cnt) / 0x20][((off - cpureg_perf_cnt) % 0x20) / 8];
+			switch (off & 0b110) {
+				case 0:
+					perf_shadow = counter >> 16;
+					return counter & 0xffff;
+				default:
+					return perf_shadow >> (((off & 0b110) - 2) * 8);
+			}
+		}
+		if (off >= cpureg_task_ctx) {
+			uint32_t ctx = (off - cpureg_task_ctx) / 0x40;
+			uint32_t r = ((off - cpureg_task_ctx) % 0x40) / 4;
+			uint32_t v = r == 0 ? 0 : regs[ctx][r];
+			return (off & 2) ? v >> 16 : v & 0xffff;
+		}
+		switch (off) {
+			case cpureg_irq_base:      return irq_base & 0xffff;
+			case cpureg_irq_base + 2:  return irq_base >> 16;
+			case cpureg_irq_en:        return irq_en;
+			case cpureg_task_active:   return task_active;
+			case cpureg_mem_layout:    return mem_layout;
+			default:                   return 0;
+		}
+	}
+
+	void cpu::cpureg_write(uint32_t addr, uint16_t value, uint8_t mask) {
+		uint32_t off = (addr & 0x3fff'fffe);
+		if (off >= cpureg_end) return;
+		if (off >= cpureg_task_ctx) {
+			uint32_t ctx = (off - cpureg_task_ctx) / 0x40;
+			uint32_t r = ((off - cpureg_task_ctx) % 0x40) / 4;
+			if (r == 0) return;
+			uint32_t &v = regs[ctx][r];
+			if (off & 2) v = (v & 0xffff) | (merge(v >> 16, value, mask) << 16);
+			else v = (v & 0xffff'0000) | merge(v & 0xffff, value, mask);
+			return;
+		}
+		switch (off) {
+			case cpureg_irq_base:
+				// only the high half updates IRQ_BASE, the low half is shadowed until then
+				irq_base_shadow = merge(irq_base_shadow, value, mask);
+				break;
+			case cpureg_irq_base + 2:
+				irq_base = ((uint32_t)merge(irq_base >> 16, value, mask) << 16) | irq_base_shadow;
+				break;
+			case cpureg_irq_en:
+				irq_en = merge(irq_en, value, mask);
+				break;
+			case cpureg_task_active:
+				task_active = merge(task_active, value, mask) & 0b11;
+				break;
+			case cpureg_mem_layout:
+				mem_layout = merge(mem_layout, value, mask) & 0b1111;
+				break;
+			case cpureg_perf_reset:
+				value &= merge(0, 0xffff, mask);
+				for (int i = 0; i < 16; ++i) {
+					if (value & (1 << i)) perf[i / 4][i % 4] = 0;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+}
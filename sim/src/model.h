@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include "memory.h"
+#include "insns.h"
+
+namespace msim {
+	// What a single retired instruction (or interrupt entry) did to architectural state. This is
+	// what the lockstep harness compares against the core's retire port.
+	struct retire {
+		uint32_t pc = 0;
+		uint32_t task = 0;
+		uint32_t raw = 0; // instruction bits, short instructions only use the low halfword
+		uint32_t next_pc = 0;
+
+		// set if this record is an interrupt entry instead of an instruction
+		bool irq = false;
+		uint32_t irq_number = 0;
+
+		// register writeback (never reported for r0 or pc; pc changes show up in next_pc)
+		bool wb = false;
+		uint32_t wb_reg = 0, wb_value = 0;
+
+		// memory accesses, addresses are byte addresses
+		bool load = false;
+		uint32_t load_addr = 0;
+		// the loaded value depends on timing (performance counters), so the core's value wins
+		bool load_volatile = false;
+		bool store = false;
+		uint32_t store_addr = 0;
+		uint16_t store_data = 0; // as it appears on the bus
+		uint8_t store_mask = 0;
+
+		// pc was written
+		bool taken = false;
+	};
+
+	// Instruction-level reference model of the mcpu, including the cpu-internal register block
+	// (interrupts, task contexts and MEM_LAYOUT) described in progmodel.md.
+	struct cpu {
+		explicit cpu(memory &mem);
+
+		void reset();
+
+		// Execute a single instruction. If auto_irq is set and an interrupt can be taken, the
+		// interrupt is entered instead and its record returned.
+		retire step();
+
+		// Enter an interrupt as the core does between instructions.
+		retire enter_irq(uint32_t number);
+
+		// Latch an interrupt request; it stays pending until entered.
+		void raise_irq(uint32_t number) {
+			irq_pending |= (1u << number);
+		}
+
+		// Lowest-numbered enabled, pending interrupt, or -1 if none can be taken right now
+		int next_irq() const;
+
+		// Architectural register read, with r0/pc handling
+		uint32_t reg(uint32_t r) const;
+		uint32_t pc() const {return regs[task_active][15];}
+
+		memory &mem;
+		bool auto_irq = true;
+
+		uint32_t regs[4][16]{};
+
+		// cpu-internal registers
+		uint32_t irq_base = 0, irq_base_shadow = 0;
+		uint32_t irq_en = 0;
+		uint32_t irq_pending = 0;
+		uint32_t task_active = 0;
+		uint32_t mem_layout = reset_mem_layout;
+
+		// performance counters, perf[task][n] as in PERF_CNT(task, n). The model has no notion of
+		// time, so PERF_CYCLES goes up by one per instruction unless something else drives it.
+		enum {
+			PERF_CYCLES,
+			PERF_RETIRED,
+			PERF_TAKEN,
+			PERF_STALL
+		};
+		uint64_t perf[4][4]{};
+		uint64_t perf_shadow = 0;
+
+	private:
+		uint16_t bus_read(uint32_t addr);
+		void bus_write(uint32_t addr, uint16_t value, uint8_t mask);
+
+		uint16_t cpureg_read(uint32_t addr);
+		void cpureg_write(uint32_t addr, uint16_t value, uint8_t mask);
+
+		void execute(const masm::insn::decoded& d, retire& r);
+	};
+}
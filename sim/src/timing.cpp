@@ -0,0 +1,85 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace msim {
+	static const char *target_names[target_count] = {"rom", "sram", "sdram", "unmapped", "cpuregs", "vram"};
+
+	const char *target_name(target t) {
+		return target_names[(uint32_t)t];
+	}
+
+	void timing::load(const std::string& path) {
+		std::ifstream f(path);
+		if (!f) throw std::runtime_error("unable to open timing file " + path);
+
+		static const char *names[] = {"S", "A", "L", "B", "M", "F", "T"};
+
+		std::string name;
+		uint32_t value;
+		while (f >> name) {
+			if (name[0] == '#') {
+				std::getline(f, name);
+				continue;
+			}
+			if (!(f >> value)) throw std::runtime_error("expected a cycle count for " + name + " in " + path);
+
+			if (name == "taken") taken = value;
+			else if (name == "irq") irq = value;
+			else if (name == "div") divide = value;
+			else if (auto it = std::find(std::begin(names), std::end(names), name); it != std::end(names)) encoding[it - std::begin(names)] = value;
+			else if (auto it = std::find(std::begin(target_names), std::end(target_names), name); it != std::end(target_names)) {
+				if (!value) throw std::runtime_error("bus latency for " + name + " must be at least 1 in " + path);
+				latency[it - std::begin(target_names)] = value;
+			}
+			else throw std::runtime_error("unknown timing " + name + " in " + path);
+		}
+	}
+
+	uint64_t estimate::add(const retire& r, uint32_t mem_layout, const timing& t) {
+		if (r.irq) {
+			++irqs;
+			irq_entry += t.irq;
+			cycles += t.irq;
+			return t.irq;
+		}
+
+		auto d = masm::insn::decode(r.raw);
+		uint64_t spent = t.encoding[d.fmt];
+		if (uint32_t op = (d.opcode >> 2) & 0b1111; (d.opcode >> 6) && (op == masm::insn::alu_op::DIV || op == masm::insn::alu_op::MOD)) spent += t.divide;
+		issue += spent;
+
+		// every bus word of the instruction, which only matters if it straddles a region boundary
+		for (uint32_t addr = r.pc; addr < r.pc + d.length(); addr += 2) {
+			auto i = (uint32_t)target_for(addr, mem_layout);
+			++fetches[i];
+			fetch_stall[i] += t.latency[i] - 1;
+			spent += t.latency[i] - 1;
+		}
+
+		if (r.load || r.store) {
+			auto i = (uint32_t)target_for(r.load ? r.load_addr : r.store_addr, mem_layout);
+			++accesses[i];
+			data_stall[i] += t.latency[i] - 1;
+			spent += t.latency[i] - 1;
+		}
+
+		++retired;
+		if (r.taken) {
+			++taken;
+			refill += t.taken;
+			spent += t.taken;
+		}
+
+		cycles += spent;
+		return spent;
+	}
+
+	uint64_t estimate::stall() const {
+		uint64_t total = 0;
+		for (size_t i = 0; i < target_count; ++i) total += fetch_stall[i] + data_stall[i];
+		return total;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <string>
+#include "cycles.h"
+#include "memory.h"
+#include "model.h"
+
+namespace msim {
+	// Number of bus targets, indexed by msim::target
+	inline constexpr size_t target_count = 6;
+
+	// Approximate cycle costs, for comparing how code and memory layouts perform without running the
+	// RTL. The issue costs assume every bus access completes in a single cycle; slower targets add
+	// stall cycles on top. The defaults are the ones in cycles.h (which mcasm --wcet also starts
+	// from), and a timing file overrides them with "name value" lines:
+	//
+	//   S A L B M F T                     issuing an instruction with that encoding
+	//   taken                             extra for anything that wrote pc (refilling the pipeline)
+	//   irq                               entering an interrupt
+	//   div                               extra for div/mod, which wait on the divider
+	//   rom sram sdram unmapped cpuregs vram
+	//                                     cycles for one bus word access to that target (as in
+	//                                     mcpu-tb's bus model), anything above 1 counts as stall
+	struct timing {
+		std::array<uint32_t, 7> encoding = masm::cycles::issue;
+		uint32_t taken = masm::cycles::taken;
+		uint32_t irq = masm::cycles::irq;
+		uint32_t divide = masm::cycles::divide;
+		std::array<uint32_t, target_count> latency = masm::cycles::latency;
+
+		// Throws std::runtime_error if the file can't be read or has unknown names in it
+		void load(const std::string& path);
+	};
+
+	// Running totals for a stream of retire records, with the stall cycles split by which bus
+	// target (and which port) caused them.
+	struct estimate {
+		uint64_t cycles = 0;
+		uint64_t retired = 0, taken = 0, irqs = 0;
+
+		// cycles spent issuing (including waiting on the divider), refilling after taken jumps and entering interrupts
+		uint64_t issue = 0, refill = 0, irq_entry = 0;
+
+		// bus words moved and stall cycles, by target
+		uint64_t fetches[target_count]{}, accesses[target_count]{};
+		uint64_t fetch_stall[target_count]{}, data_stall[target_count]{};
+
+		// Account for one record, given the MEM_LAYOUT it executed under (i.e. read before the
+		// step, since the instruction itself may change it). Returns the cycles it took.
+		uint64_t add(const retire& r, uint32_t mem_layout, const timing& t);
+
+		uint64_t stall() const;
+	};
+
+	// Lower-case name of a target, as used in timing files and reports
+	const char *target_name(target t);
+}
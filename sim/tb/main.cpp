@@ -0,0 +1,307 @@
+// Lockstep co-simulation of the verilated core against the reference model.
+//
+// The core and the model each get their own copy of memory. Every record on the core's retire
+// port is checked against the model stepping the same instruction, and every store the core puts
+// on its data bus is checked against the store the model made. On the first divergence the run is
+// repeated from reset with waveform tracing enabled only in a window around it.
+
+#include <Vcpu.h>
+#include <verilated.h>
+#include <verilated_fst_c.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "cycles.h"
+#include "image.h"
+#include "memory.h"
+#include "model.h"
+
+namespace {
+	struct options {
+		std::string image;
+		std::string trace = "divergence.fst";
+		uint64_t max_cycles = 100'000'000;
+		uint64_t window = 2000;
+		uint32_t sdram_latency = masm::cycles::latency[(size_t)msim::target::SDRAM];
+		int irq_line = -1;
+		uint64_t irq_period = 0;
+	};
+
+	struct outcome {
+		bool diverged = false;
+		uint64_t cycle = 0;
+		uint64_t retired = 0;
+		std::string reason;
+	};
+
+	struct store_record {
+		uint32_t addr;
+		uint16_t data;
+		uint8_t mask;
+	};
+
+	uint32_t latency_for(const options& opt, msim::target t) {
+		if (t == msim::target::SDRAM) return opt.sdram_latency;
+		return masm::cycles::latency[(size_t)t];
+	}
+
+	// Bus target model for one of the core's ports
+	struct port {
+		bool busy = false, acked = false;
+		uint32_t countdown = 0;
+
+		// Called after every rising edge; returns true when the access completes this cycle
+		// (i.e. ack should be driven for the next edge).
+		bool tick(const options& opt, bool req, uint32_t byte_addr, uint32_t mem_layout) {
+			if (acked) {
+				// ack was seen on this edge, so the current req (if any) is a new access
+				acked = busy = false;
+			}
+			if (req && !busy) {
+				busy = true;
+				countdown = latency_for(opt, msim::target_for(byte_addr, mem_layout)) - 1;
+			}
+			if (!busy) return false;
+			if (countdown) {
+				--countdown;
+				return false;
+			}
+			acked = true;
+			return true;
+		}
+	};
+
+	char describe_buf[512];
+
+	const char *describe(const msim::retire& r) {
+		if (r.irq) snprintf(describe_buf, sizeof describe_buf, "irq %u in task %u at pc %08x -> %08x", r.irq_number, r.task, r.pc, r.next_pc);
+		else snprintf(describe_buf, sizeof describe_buf, "task %u pc %08x (%08x) wb=%d r%u=%08x next %08x", r.task, r.pc, r.raw, r.wb, r.wb_reg, r.wb_value, r.next_pc);
+		return describe_buf;
+	}
+
+	outcome run(const options& opt, const std::vector<msim::image_view>& image, std::optional<std::pair<uint64_t, uint64_t>> trace_window) {
+		auto ctx = std::make_unique<VerilatedContext>();
+		ctx->traceEverOn(trace_window.has_value());
+		auto top = std::make_unique<Vcpu>(ctx.get());
+
+		std::unique_ptr<VerilatedFstC> tfp;
+		if (trace_window) {
+			tfp = std::make_unique<VerilatedFstC>();
+			top->trace(tfp.get(), 99);
+		}
+
+		msim::memory dut_mem, ref_mem;
+		dut_mem.load(image);
+		ref_mem.load(image);
+		msim::cpu ref(ref_mem);
+		ref.auto_irq = false; // interrupts are entered when the core reports doing so
+
+		port ibus, dbus;
+		std::deque<store_record> stores;
+		outcome result;
+
+		auto diverge = [&](uint64_t cycle, std::string why) {
+			result.diverged = true;
+			result.cycle = cycle;
+			result.reason = std::move(why);
+		};
+
+		auto check_retire = [&](uint64_t cycle) {
+			msim::retire expect;
+			if (top->retire_irq) {
+				if (ref.next_irq() != (int)top->retire_irq_number) {
+					diverge(cycle, "core entered irq " + std::to_string(top->retire_irq_number) + " that the model could not take");
+					return;
+				}
+				expect = ref.enter_irq(top->retire_irq_number);
+			}
+			else {
+				expect = ref.step();
+				if (expect.store && msim::target_for(expect.store_addr, ref.mem_layout) != msim::target::CPUREGS) {
+					if (stores.empty()) {
+						diverge(cycle, std::string("model stored but core did not: ") + describe(expect));
+						return;
+					}
+					auto s = stores.front();
+					stores.pop_front();
+					uint16_t m = (s.mask & 1 ? 0x00ff : 0) | (s.mask & 2 ? 0xff00 : 0);
+					if (s.addr != (expect.store_addr & ~1u) || s.mask != expect.store_mask || (s.data & m) != (expect.store_data & m)) {
+						char buf[128];
+						snprintf(buf, sizeof buf, "store mismatch: core %08x=%04x/%x, model %08x=%04x/%x: ", s.addr, s.data, s.mask, expect.store_addr, expect.store_data, expect.store_mask);
+						diverge(cycle, buf + std::string(describe(expect)));
+						return;
+					}
+				}
+			}
+
+			if (expect.load_volatile && expect.wb && expect.wb_reg == top->retire_wb_reg) {
+				// performance counter reads depend on timing the model doesn't have
+				ref.regs[expect.task][expect.wb_reg] = expect.wb_value = top->retire_wb_value;
+			}
+
+			bool ok = expect.irq == (bool)top->retire_irq &&
+				expect.pc == top->retire_pc &&
+				expect.next_pc == top->retire_next_pc &&
+				expect.task == top->retire_task &&
+				expect.wb == (bool)top->retire_wb &&
+				(!expect.wb || (expect.wb_reg == top->retire_wb_reg && expect.wb_value == top->retire_wb_value));
+			if (!ok) {
+				char buf[256];
+				snprintf(buf, sizeof buf, "retire mismatch: core task %u pc %08x wb=%d r%u=%08x next %08x irq=%d; model ",
+					top->retire_task, top->retire_pc, top->retire_wb, top->retire_wb_reg, top->retire_wb_value, top->retire_next_pc, top->retire_irq);
+				diverge(cycle, buf + std::string(describe(expect)));
+			}
+		};
+
+		top->rst = 1;
+		top->clk = 0;
+		top->irq = 0;
+		top->ibus_ack = top->dbus_ack = 0;
+
+		for (uint64_t cycle = 0; cycle < opt.max_cycles && !ctx->gotFinish(); ++cycle) {
+			bool tracing = trace_window && cycle >= trace_window->first && cycle <= trace_window->second;
+			if (tracing && !tfp->isOpen()) tfp->open(opt.trace.c_str());
+
+			if (cycle == 4) top->rst = 0;
+
+			// interrupt stimulus, pulsed for a single cycle
+			bool fire = opt.irq_line >= 0 && opt.irq_period && cycle && cycle % opt.irq_period == 0;
+			top->irq = fire ? (1u << opt.irq_line) : 0;
+			if (fire) ref.raise_irq(opt.irq_line);
+
+			top->clk = 1;
+			top->eval();
+			if (tracing) tfp->dump(ctx->time());
+			ctx->timeInc(1);
+
+			if (!top->rst && top->retire_valid && !result.diverged) {
+				++result.retired;
+				check_retire(cycle);
+				// when tracing, keep going to the end of the window
+				if (result.diverged && !trace_window) break;
+			}
+			if (trace_window && cycle > trace_window->second) break;
+
+			// service the buses for the next edge
+			uint32_t layout = top->mem_layout;
+			uint32_t iaddr = top->ibus_addr << 1, daddr = top->dbus_addr << 1;
+
+			top->ibus_ack = ibus.tick(opt, top->ibus_req, iaddr, layout);
+			if (top->ibus_ack) top->ibus_rdata = dut_mem.read16(iaddr, layout);
+
+			top->dbus_ack = dbus.tick(opt, top->dbus_req, daddr, layout);
+			if (top->dbus_ack) {
+				if (top->dbus_we) {
+					dut_mem.write16(daddr, top->dbus_wdata, top->dbus_wmask, layout);
+					stores.push_back({daddr, (uint16_t)top->dbus_wdata, (uint8_t)top->dbus_wmask});
+				}
+				else top->dbus_rdata = dut_mem.read16(daddr, layout);
+			}
+
+			top->clk = 0;
+			top->eval();
+			if (tracing) tfp->dump(ctx->time());
+			ctx->timeInc(1);
+
+			if (!result.diverged) result.cycle = cycle;
+		}
+
+		if (tfp && tfp->isOpen()) tfp->close();
+		top->final();
+		return result;
+	}
+
+	void usage() {
+		fputs(
+			"usage: mcpu-tb [options] image.bin\n"
+			"  --max-cycles N      stop after N cycles\n"
+			"  --window N          trace N cycles before (and N/4 after) a divergence\n"
+			"  --trace FILE        waveform output for the divergence window\n"
+			"  --sdram-latency N   bus latency for sdram accesses (at least 1)\n"
+			"  --irq LINE:PERIOD   pulse an interrupt line every PERIOD cycles\n",
+			stderr
+		);
+	}
+}
+
+int main(int argc, char ** argv) {
+	Verilated::commandArgs(argc, argv);
+
+	options opt;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto value = [&]() -> const char * {
+			if (i + 1 >= argc) {
+				usage();
+				exit(2);
+			}
+			return argv[++i];
+		};
+
+		if (arg == "--max-cycles") opt.max_cycles = strtoull(value(), nullptr, 0);
+		else if (arg == "--window") opt.window = strtoull(value(), nullptr, 0);
+		else if (arg == "--trace") opt.trace = value();
+		else if (arg == "--sdram-latency") {
+			// an access always takes at least the cycle it's acked in
+			opt.sdram_latency = strtoul(value(), nullptr, 0);
+			if (!opt.sdram_latency) {
+				usage();
+				return 2;
+			}
+		}
+		else if (arg == "--irq") {
+			const char *v = value();
+			char *end;
+			opt.irq_line = strtol(v, &end, 0);
+			if (*end != ':' || opt.irq_line < 0 || opt.irq_line > 15) {
+				usage();
+				return 2;
+			}
+			opt.irq_period = strtoull(end + 1, nullptr, 0);
+		}
+		else if (arg[0] == '+') continue; // verilator runtime args
+		else if (opt.image.empty() && arg[0] != '-') opt.image = arg;
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (opt.image.empty()) {
+		usage();
+		return 2;
+	}
+
+	std::unique_ptr<msim::mapped_image> mapped;
+	try {
+		mapped = std::make_unique<msim::mapped_image>(opt.image);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "mcpu-tb: %s\n", e.what());
+		return 2;
+	}
+
+	const auto& image = mapped->sections();
+	auto result = run(opt, image, std::nullopt);
+	if (!result.diverged) {
+		printf("mcpu-tb: %llu cycles, %llu retired, no divergence\n", (unsigned long long)result.cycle + 1, (unsigned long long)result.retired);
+		if (!result.retired) {
+			fprintf(stderr, "mcpu-tb: core never retired an instruction\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	fprintf(stderr, "mcpu-tb: divergence at cycle %llu after %llu retired: %s\n", (unsigned long long)result.cycle, (unsigned long long)result.retired, result.reason.c_str());
+
+	// deterministic, so rerun with the trace only covering the area around the divergence
+	uint64_t from = result.cycle > opt.window ? result.cycle - opt.window : 0;
+	run(opt, image, std::make_pair(from, result.cycle + opt.window / 4));
+	fprintf(stderr, "mcpu-tb: wrote cycles %llu-%llu to %s\n", (unsigned long long)from, (unsigned long long)(result.cycle + opt.window / 4), opt.trace.c_str());
+	return 1;
+}